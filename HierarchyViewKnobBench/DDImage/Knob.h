@@ -0,0 +1,105 @@
+// -----------------------------------------------------------------------------
+// 2009-2013 by Jupiter Jazz Limited.
+//
+// This software, excluded third party dependencies, is released in public domain,
+// see unlicense.txt file for more detail.
+//
+// IMPORTATNT:
+// NUKE is a trademark of The Foundry Visionmongers Ltd.
+// Qt is a trademark of Digia Plc and/or its subsidiary(-ies).
+// -----------------------------------------------------------------------------
+
+/// stub of DD::Image::Knob for HierarchyViewKnobBench, it is NOT part of Nuke
+/// NDK; it only provides what libHierarchyViewKnob uses, so that the library
+/// can be built and driven outside of Nuke: undo and widget callbacks do
+/// nothing, Hash is a plain FNV-1a hash
+
+#ifndef HIERARCHY_VIEW_BENCH_DDIMAGE_KNOB_H
+#define HIERARCHY_VIEW_BENCH_DDIMAGE_KNOB_H
+
+#include <ostream>
+
+class QWidget;
+typedef QWidget* WidgetPointer;
+
+namespace DD
+{
+namespace Image
+{
+
+class Knob_Closure
+{
+};
+
+class WidgetContext
+{
+};
+
+class OutputContext
+{
+public:
+    OutputContext() : frame_( 1.0 ) {}
+    inline double frame() const { return frame_; }
+    inline void setFrame( double _frame ) { frame_ = _frame; }
+
+private:
+    double frame_;
+};
+
+class Hash
+{
+public:
+    Hash() : value_( 14695981039346656037ULL ) {}
+    inline void append( const void* _data, int _len )
+    {
+        const unsigned char* p( static_cast< const unsigned char* >( _data ) );
+        for ( int idx( 0 ); idx < _len; ++idx ) {
+            value_ = ( value_ ^ p[ idx ] ) * 1099511628211ULL;
+        }
+    }
+    inline void append( int _v ) { append( &_v, sizeof( _v ) ); }
+    inline void append( unsigned int _v ) { append( &_v, sizeof( _v ) ); }
+    inline void append( double _v ) { append( &_v, sizeof( _v ) ); }
+    inline unsigned long long value() const { return value_; }
+
+private:
+    unsigned long long value_;
+};
+
+enum StoreType
+{
+    Custom
+};
+
+class Knob
+{
+public:
+    enum CallbackReason
+    {
+        kIsVisible,
+        kUpdateWidgets,
+        kDestroying
+    };
+    typedef int ( *Callback )( void* _closure, CallbackReason _reason );
+
+    Knob( Knob_Closure* _kc, const char* _name, const char* _label = 0 ) {}
+    virtual ~Knob() {}
+
+    virtual const char* Class() const = 0;
+    virtual bool not_default() const { return false; }
+    virtual void to_script( std::ostream& _os, const OutputContext* _oc, bool _quote ) const {}
+    virtual bool from_script( const char* _v ) { return false; }
+    virtual void store( StoreType _type, void* _data, Hash& _hash, const OutputContext& _oc ) {}
+    virtual const char* get_text( const OutputContext* _oc = 0 ) const { return 0; }
+    virtual WidgetPointer make_widget( const WidgetContext& _context ) { return 0; }
+
+    inline void addCallback( Callback _cb, void* _closure ) {}
+    inline void removeCallback( Callback _cb, void* _closure ) {}
+    inline void new_undo( const char* _name = 0 ) {}
+    inline void changed() {}
+};
+
+} // namespace Image
+} // namespace DD
+
+#endif
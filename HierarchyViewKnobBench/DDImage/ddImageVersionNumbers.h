@@ -0,0 +1,20 @@
+// -----------------------------------------------------------------------------
+// 2009-2013 by Jupiter Jazz Limited.
+//
+// This software, excluded third party dependencies, is released in public domain,
+// see unlicense.txt file for more detail.
+//
+// IMPORTATNT:
+// NUKE is a trademark of The Foundry Visionmongers Ltd.
+// Qt is a trademark of Digia Plc and/or its subsidiary(-ies).
+// -----------------------------------------------------------------------------
+
+/// stub of the DDImage version header for HierarchyViewKnobBench, it is NOT
+/// part of Nuke NDK, see Knob.h of this directory
+
+#ifndef HIERARCHY_VIEW_BENCH_DDIMAGE_VERSION_NUMBERS_H
+#define HIERARCHY_VIEW_BENCH_DDIMAGE_VERSION_NUMBERS_H
+
+#define kDDImageVersionInteger 70000
+
+#endif
@@ -0,0 +1,613 @@
+// -----------------------------------------------------------------------------
+// 2009-2013 by Jupiter Jazz Limited.
+//
+// This software, excluded third party dependencies, is released in public domain,
+// see unlicense.txt file for more detail.
+//
+// IMPORTATNT:
+// NUKE is a trademark of The Foundry Visionmongers Ltd.
+// Qt is a trademark of Digia Plc and/or its subsidiary(-ies).
+// -----------------------------------------------------------------------------
+
+/// Command line load test of HierarchyViewKnob, built against the stub DDImage
+/// layer of this directory: synthesizes a hierarchy, replays an interaction
+/// trace against the knob and prints the latency histogram of each operation.
+///
+/// Trace format, one operation per line, '#' starts a comment:
+///     reset                   rebuild the hierarchy from the current states
+///     item <idx> <0|1>        setItemState()
+///     state <idx> <0|1>       setState(), the flattened state only
+///     toggle <idx> <0|1>      check or uncheck the row of flattened index
+///                             <idx> in the widget as a click does, through
+///                             itemChanged() and the item states update
+///     to_script               serialize the knob, the text is kept
+///     from_script             load the text of the last to_script
+///     store                   hash the states as Nuke does before cooking
+///     get_text                get the text form of the states
+/// The comment lines written by '--record' before the first operation hold
+/// the options of the hierarchy and its size, '--trace' applies the options
+/// and verifies the size, as the indices are only valid for that hierarchy.
+///
+/// '--check' verifies the hierarchy built by the knob against a reference
+/// built from the same items, e.g. for wide levels or names repeated at
+/// different depths, and returns 1 if anything differs.
+
+#include "HierarchyViewKnob.h"
+#include "HierarchyViewWidget.moc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <QApplication>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+namespace
+{
+
+/// monotonic clock in nanoseconds
+double nowNanoseconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    ::QueryPerformanceFrequency( &freq );
+    ::QueryPerformanceCounter( &counter );
+    return static_cast< double >( counter.QuadPart ) * 1e9 / static_cast< double >( freq.QuadPart );
+#else
+    timespec ts;
+    ::clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast< double >( ts.tv_sec ) * 1e9 + static_cast< double >( ts.tv_nsec );
+#endif
+}
+
+/// small deterministic generator, so that a seed gives the same workload on
+/// every platform
+class Random
+{
+public:
+    explicit Random( unsigned long long _seed ) : state_( _seed * 2862933555777941757ULL + 3037000493ULL ) {}
+
+    inline unsigned int next()
+    {
+        state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast< unsigned int >( state_ >> 33 );
+    }
+
+    /// uniform in '[ 0, _n )'
+    inline unsigned int below( unsigned int _n ) { return _n ? next() % _n : 0; }
+
+private:
+    unsigned long long state_;
+};
+
+struct Options
+{
+    Options()
+        : fanout( 10 ), depth( 4 ), nameLength( 8 ), duplicates( 0 ), maxItems( 0 ), seed( 1 ),
+          ops( 1000 ), trace( NULL ), record( NULL ), check( false ) {}
+
+    int fanout;
+    int depth;
+    int nameLength;
+    /// percent of the names replaced by a name shared by all the siblings
+    int duplicates;
+    /// 0 for all the fanout ^ depth leaves
+    int maxItems;
+    unsigned long seed;
+    int ops;
+    const char* trace;
+    const char* record;
+    bool check;
+};
+
+/// set an option of the command line or of a trace header, returns false for
+/// an unknown option
+bool parseOption( Options& _opt, const std::string& _arg, const char* _value )
+{
+    if ( _arg == "--fanout" ) {
+        _opt.fanout = ::atoi( _value );
+    } else if ( _arg == "--depth" ) {
+        _opt.depth = ::atoi( _value );
+    } else if ( _arg == "--name-length" ) {
+        _opt.nameLength = ::atoi( _value );
+    } else if ( _arg == "--duplicates" ) {
+        _opt.duplicates = ::atoi( _value );
+    } else if ( _arg == "--items" ) {
+        _opt.maxItems = ::atoi( _value );
+    } else if ( _arg == "--seed" ) {
+        _opt.seed = ::strtoul( _value, NULL, 10 );
+    } else if ( _arg == "--ops" ) {
+        _opt.ops = ::atoi( _value );
+    } else if ( _arg == "--trace" ) {
+        _opt.trace = _value;
+    } else if ( _arg == "--record" ) {
+        _opt.record = _value;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// leaves of a tree of 'fanout' children per level, names are 'l<level>_<child>'
+/// padded up to 'nameLength', so the same names repeat under every parent;
+/// with 'duplicates' a part of the children are all named 'dup' instead,
+/// which merges siblings and produces repeated full paths
+void synthesize( const Options& _opt, std::vector< std::string >& _items )
+{
+    std::size_t leafSize( 1 );
+    for ( int level( 0 ); level < _opt.depth; ++level ) {
+        leafSize *= static_cast< std::size_t >( _opt.fanout );
+    }
+    if ( _opt.maxItems > 0 ) {
+        leafSize = std::min( leafSize, static_cast< std::size_t >( _opt.maxItems ) );
+    }
+
+    _items.clear();
+    _items.reserve( leafSize );
+    char name[ 64 ];
+    for ( std::size_t leaf( 0 ); leaf < leafSize; ++leaf ) {
+        std::string path;
+        std::size_t rest( leaf );
+        for ( int level( 0 ); level < _opt.depth; ++level ) {
+            std::size_t divisor( 1 );
+            for ( int idx( level + 1 ); idx < _opt.depth; ++idx ) {
+                divisor *= static_cast< std::size_t >( _opt.fanout );
+            }
+            std::size_t child( rest / divisor );
+            rest %= divisor;
+
+            /// the choice depends on the node only, so all the leaves below
+            /// a node agree on its name
+            Random random( _opt.seed ^ ( static_cast< unsigned long long >( leaf - rest ) << 8 ) ^ static_cast< unsigned long long >( level ) );
+            if ( static_cast< int >( random.below( 100 ) ) < _opt.duplicates ) {
+                ::sprintf( name, "dup" );
+            } else {
+                ::sprintf( name, "l%d_%lu", level, static_cast< unsigned long >( child ) );
+            }
+            path.push_back( '/' );
+            path.append( name );
+            if ( static_cast< int >( ::strlen( name ) ) < _opt.nameLength ) {
+                path.append( _opt.nameLength - ::strlen( name ), 'x' );
+            }
+        }
+        _items.push_back( path );
+    }
+}
+
+/// random trace, toggles are the majority as in interactive use
+void generateTrace( const Options& _opt, int _itemLen, int _stateLen, std::vector< std::string >& _trace )
+{
+    Random random( _opt.seed );
+    char line[ 64 ];
+    _trace.clear();
+    _trace.push_back( "reset" );
+    for ( int op( 0 ); op < _opt.ops; ++op ) {
+        unsigned int kind( random.below( 100 ) );
+        if ( kind < 40 ) {
+            ::sprintf( line, "item %u %u", random.below( static_cast< unsigned int >( _itemLen ) ), random.below( 2 ) );
+        } else if ( kind < 55 ) {
+            ::sprintf( line, "state %u %u", random.below( static_cast< unsigned int >( _stateLen ) ), random.below( 2 ) );
+        } else if ( kind < 70 ) {
+            ::sprintf( line, "toggle %u %u", random.below( static_cast< unsigned int >( _stateLen ) ), random.below( 2 ) );
+        } else if ( kind < 80 ) {
+            ::sprintf( line, "store" );
+        } else if ( kind < 87 ) {
+            ::sprintf( line, "get_text" );
+        } else if ( kind < 93 ) {
+            ::sprintf( line, "to_script" );
+        } else if ( kind < 98 ) {
+            ::sprintf( line, "from_script" );
+        } else {
+            ::sprintf( line, "reset" );
+        }
+        _trace.push_back( line );
+    }
+}
+
+/// the comment lines written by '--record' before the operations
+struct TraceHeader
+{
+    TraceHeader() : options(), itemLen( -1 ), stateLen( -1 ) {}
+    std::string options;
+    long itemLen;
+    long stateLen;
+};
+
+bool readTrace( const char* _path, std::vector< std::string >& _trace, TraceHeader& _header )
+{
+    std::ifstream in( _path );
+    if ( !in ) {
+        return false;
+    }
+    _trace.clear();
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        std::string::size_type comment( line.find( '#' ) );
+        if ( comment != std::string::npos ) {
+            if ( _trace.empty() ) {
+                std::string text( line, comment + 1 );
+                long itemLen( 0 ), stateLen( 0 );
+                if ( text.find( "--" ) != std::string::npos && _header.options.empty() ) {
+                    _header.options = text;
+                } else if ( ::sscanf( text.c_str(), " %ld items, %ld states", &itemLen, &stateLen ) == 2 ) {
+                    _header.itemLen = itemLen;
+                    _header.stateLen = stateLen;
+                }
+            }
+            line.erase( comment );
+        }
+        if ( line.find_first_not_of( " \t\r" ) != std::string::npos ) {
+            _trace.push_back( line );
+        }
+    }
+    return true;
+}
+
+/// the rows of the widget by flattened index, rebuilt after every reset()
+void collectRows( const HierarchyViewWidget* _widget, std::vector< QTreeWidgetItem* >& _rows )
+{
+    _rows.clear();
+    if ( !_widget ) {
+        return;
+    }
+    for ( QTreeWidgetItemIterator itemIt( const_cast< HierarchyViewWidget* >( _widget ) ); ( *itemIt ); ++itemIt ) {
+        int idx( _widget->getAbsIndex( *itemIt ) );
+        if ( idx >= 0 ) {
+            if ( static_cast< std::size_t >( idx ) >= _rows.size() ) {
+                _rows.resize( static_cast< std::size_t >( idx ) + 1, NULL );
+            }
+            _rows[ idx ] = *itemIt;
+        }
+    }
+}
+
+/// reference hierarchy of the items, built the simple way: a map from the
+/// parent and the name to the node, nodes numbered in creation order and the
+/// children in the order they first appear, as the knob promises
+struct ReferenceHierarchy
+{
+    explicit ReferenceHierarchy( const std::vector< std::string >& _items )
+        : nodeParents(), nodeNames(), nodeChildren(), roots(), itemNodes( _items.size(), -1 ), nodeFirstItems()
+    {
+        std::map< std::pair< int, std::string >, int > nodes;
+        for ( std::size_t itemIdx( 0 ); itemIdx < _items.size(); ++itemIdx ) {
+            const std::string& path( _items[ itemIdx ] );
+            int parent( -1 );
+            std::string::size_type begin( path.find_first_not_of( '/' ) );
+            while ( begin != std::string::npos ) {
+                std::string::size_type end( path.find( '/', begin ) );
+                std::string name( path, begin, end == std::string::npos ? std::string::npos : end - begin );
+                std::map< std::pair< int, std::string >, int >::const_iterator it( nodes.find( std::make_pair( parent, name ) ) );
+                int node( 0 );
+                if ( it != nodes.end() ) {
+                    node = it->second;
+                } else {
+                    node = static_cast< int >( nodeParents.size() );
+                    nodes.insert( std::make_pair( std::make_pair( parent, name ), node ) );
+                    nodeParents.push_back( parent );
+                    nodeNames.push_back( name );
+                    nodeChildren.push_back( std::vector< int >() );
+                    nodeFirstItems.push_back( -1 );
+                    ( parent < 0 ? roots : nodeChildren[ parent ] ).push_back( node );
+                }
+                parent = node;
+                begin = end == std::string::npos ? end : path.find_first_not_of( '/', end );
+            }
+            itemNodes[ itemIdx ] = parent;
+            if ( parent >= 0 && nodeFirstItems[ parent ] < 0 ) {
+                nodeFirstItems[ parent ] = static_cast< int >( itemIdx );
+            }
+        }
+    }
+
+    std::vector< int > nodeParents;
+    std::vector< std::string > nodeNames;
+    std::vector< std::vector< int > > nodeChildren;
+    std::vector< int > roots;
+    std::vector< int > itemNodes;
+    std::vector< int > nodeFirstItems;
+};
+
+int checkFailures( 0 );
+
+void checkThat( bool _ok, const char* _what, int _idx )
+{
+    if ( !_ok ) {
+        /// the first failures are enough to start from
+        if ( checkFailures < 10 ) {
+            ::fprintf( stderr, "check failed: %s, index %d\n", _what, _idx );
+        }
+        ++checkFailures;
+    }
+}
+
+/// the row of '_node' and its children, in order, against the reference
+void checkRow( const HierarchyViewWidget* _widget, const QTreeWidgetItem* _row, const ReferenceHierarchy& _ref, int _node )
+{
+    checkThat( _widget->getAbsIndex( _row ) == _node, "row order ( findChild / sibling order )", _node );
+    checkThat( _row->text( 0 ).toUtf8().constData() == _ref.nodeNames[ _node ], "row name", _node );
+    const std::vector< int >& children( _ref.nodeChildren[ _node ] );
+    checkThat( _row->childCount() == static_cast< int >( children.size() ), "child count", _node );
+    for ( int idx( 0 ); idx < _row->childCount() && idx < static_cast< int >( children.size() ); ++idx ) {
+        checkRow( _widget, _row->child( idx ), _ref, children[ idx ] );
+    }
+}
+
+/// compare the knob with the reference: the flattened nodes, the rows of the
+/// widget, the first item of every node, then the enabled items counted per
+/// subtree after random item states, which covers the subtree item ranges
+bool checkHierarchy( HierarchyViewKnob& _knob, const HierarchyViewWidget* _widget, const std::vector< std::string >& _items, int _stateLen, unsigned long _seed )
+{
+    ReferenceHierarchy ref( _items );
+    int nodeSize( static_cast< int >( ref.nodeParents.size() ) );
+    checkThat( _stateLen == nodeSize, "number of flattened nodes", _stateLen );
+
+    if ( _widget ) {
+        checkThat( _widget->topLevelItemCount() == static_cast< int >( ref.roots.size() ), "number of top level rows", -1 );
+        for ( int idx( 0 ); idx < _widget->topLevelItemCount() && idx < static_cast< int >( ref.roots.size() ); ++idx ) {
+            checkRow( _widget, _widget->topLevelItem( idx ), ref, ref.roots[ idx ] );
+        }
+    }
+
+    for ( int node( 0 ); node < nodeSize && node < _stateLen; ++node ) {
+        checkThat( _knob.getItemIndex( node ) == ref.nodeFirstItems[ node ], "first item of node", node );
+    }
+
+    Random random( _seed );
+    std::vector< int > enabled( ref.nodeParents.size(), 0 );
+    int total( 0 );
+    for ( std::size_t itemIdx( 0 ); itemIdx < _items.size(); ++itemIdx ) {
+        int state( static_cast< int >( random.below( 2 ) ) );
+        _knob.setItemState( static_cast< int >( itemIdx ), state );
+        if ( state && ref.itemNodes[ itemIdx ] >= 0 ) {
+            ++enabled[ ref.itemNodes[ itemIdx ] ];
+        }
+        total += state;
+    }
+    /// a parent is always created before its children
+    for ( int node( nodeSize - 1 ); node >= 0; --node ) {
+        if ( ref.nodeParents[ node ] >= 0 ) {
+            enabled[ ref.nodeParents[ node ] ] += enabled[ node ];
+        }
+    }
+    checkThat( _knob.countEnabled() == total, "enabled items", -1 );
+    for ( int node( 0 ); node < nodeSize && node < _stateLen; ++node ) {
+        checkThat( _knob.countEnabledInSubtree( node ) == enabled[ node ], "enabled items in subtree", node );
+        checkThat( _knob.anyEnabledInSubtree( node ) == ( enabled[ node ] > 0 ? 1 : 0 ), "any enabled item in subtree", node );
+    }
+
+    if ( checkFailures ) {
+        ::fprintf( stderr, "%d checks failed\n", checkFailures );
+        return false;
+    }
+    ::printf( "check passed: %lu items, %d flattened nodes\n", static_cast< unsigned long >( _items.size() ), nodeSize );
+    return true;
+}
+
+/// latencies of one kind of operation
+struct Samples
+{
+    explicit Samples( const char* _name ) : name( _name ), values() {}
+    std::string name;
+    std::vector< double > values;
+};
+
+void printHistogram( Samples& _samples )
+{
+    if ( _samples.values.empty() ) {
+        return;
+    }
+    std::vector< double >& v( _samples.values );
+    std::sort( v.begin(), v.end() );
+    std::size_t n( v.size() );
+    ::printf( "%-12s n=%-8lu min=%.2fus p50=%.2fus p90=%.2fus p99=%.2fus max=%.2fus\n",
+              _samples.name.c_str(), static_cast< unsigned long >( n ), v[ 0 ] / 1e3,
+              v[ n / 2 ] / 1e3, v[ n * 9 / 10 ] / 1e3, v[ std::min( n - 1, n * 99 / 100 ) ] / 1e3, v[ n - 1 ] / 1e3 );
+
+    /// power of 2 buckets in nanoseconds
+    std::vector< std::size_t > buckets( 64, 0 );
+    for ( std::size_t idx( 0 ); idx < n; ++idx ) {
+        int bucket( 0 );
+        while ( bucket < 63 && v[ idx ] >= static_cast< double >( 2ULL << bucket ) ) {
+            ++bucket;
+        }
+        ++buckets[ bucket ];
+    }
+    std::size_t peak( *std::max_element( buckets.begin(), buckets.end() ) );
+    for ( int bucket( 0 ); bucket < 64; ++bucket ) {
+        if ( buckets[ bucket ] ) {
+            int bar( static_cast< int >( ( buckets[ bucket ] * 40 + peak - 1 ) / peak ) );
+            ::printf( "  < %12.2fus %8lu %s\n", static_cast< double >( 2ULL << bucket ) / 1e3,
+                      static_cast< unsigned long >( buckets[ bucket ] ), std::string( bar, '#' ).c_str() );
+        }
+    }
+}
+
+void usage( const char* _app )
+{
+    ::fprintf( stderr,
+               "usage: %s [options]\n"
+               "  --fanout N        children per node ( 10 )\n"
+               "  --depth N         levels of the hierarchy ( 4 )\n"
+               "  --name-length N   minimum length of a name ( 8 )\n"
+               "  --duplicates P    percent of the names shared by siblings ( 0 )\n"
+               "  --items N         cap the number of items, 0 for no cap ( 0 )\n"
+               "  --seed N          seed of the hierarchy and the trace ( 1 )\n"
+               "  --ops N           length of the generated trace ( 1000 )\n"
+               "  --trace FILE      replay FILE instead of a generated trace, with the\n"
+               "                    hierarchy options of its header\n"
+               "  --record FILE     write the replayed trace to FILE\n"
+               "  --check           verify the hierarchy against a reference and exit\n",
+               _app );
+}
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+    /// the knob builds its hierarchy in the widget, a display is needed
+    QApplication app( argc, argv );
+
+    Options opt;
+    for ( int idx( 1 ); idx < argc; ++idx ) {
+        const char* arg( argv[ idx ] );
+        if ( !::strcmp( arg, "--check" ) ) {
+            opt.check = true;
+            continue;
+        }
+        const char* value( idx + 1 < argc ? argv[ idx + 1 ] : NULL );
+        if ( !value ) {
+            usage( argv[ 0 ] );
+            return 1;
+        }
+        if ( !parseOption( opt, arg, value ) ) {
+            usage( argv[ 0 ] );
+            return 1;
+        }
+        ++idx;
+    }
+
+    /// a recorded trace brings the options of its hierarchy
+    std::vector< std::string > trace;
+    TraceHeader header;
+    if ( opt.trace ) {
+        if ( !readTrace( opt.trace, trace, header ) ) {
+            ::fprintf( stderr, "can't read trace %s\n", opt.trace );
+            return 1;
+        }
+        std::istringstream in( header.options );
+        std::string arg, value;
+        while ( in >> arg >> value ) {
+            if ( arg == "--trace" || arg == "--record" || !parseOption( opt, arg, value.c_str() ) ) {
+                ::fprintf( stderr, "trace %s: unknown option '%s' in the header\n", opt.trace, arg.c_str() );
+                return 1;
+            }
+        }
+    }
+    if ( opt.fanout < 1 || opt.depth < 1 || opt.nameLength < 0 || opt.nameLength > 1024 ) {
+        usage( argv[ 0 ] );
+        return 1;
+    }
+
+    std::vector< std::string > items;
+    double begin( nowNanoseconds() );
+    synthesize( opt, items );
+    std::vector< const char* > itemPtrs( items.size() );
+    for ( std::size_t idx( 0 ); idx < items.size(); ++idx ) {
+        itemPtrs[ idx ] = items[ idx ].c_str();
+    }
+    ::printf( "synthesized %lu items in %.2fms\n", static_cast< unsigned long >( items.size() ), ( nowNanoseconds() - begin ) / 1e6 );
+
+    const char* data( "" );
+    HierarchyViewKnob knob( NULL, &data, "bench" );
+    HierarchyViewWidget* widget( qobject_cast< HierarchyViewWidget* >( knob.make_widget( DD::Image::WidgetContext() ) ) );
+    /// build once to know the size of the flattened hierarchy for the trace
+    knob.reset( itemPtrs.empty() ? NULL : &itemPtrs[ 0 ], static_cast< int >( itemPtrs.size() ), '/', "", 1 );
+    int stateLen( 0 );
+    while ( knob.getState( stateLen ) >= 0 ) {
+        ++stateLen;
+    }
+    std::vector< QTreeWidgetItem* > rows;
+    collectRows( widget, rows );
+    if ( opt.check ) {
+        return checkHierarchy( knob, widget, items, stateLen, opt.seed ) ? 0 : 1;
+    }
+
+    if ( header.itemLen >= 0 && ( header.itemLen != static_cast< long >( items.size() ) || header.stateLen != stateLen ) ) {
+        ::fprintf( stderr, "trace %s was recorded with %ld items, %ld states, the hierarchy has %lu items, %d states\n",
+                   opt.trace, header.itemLen, header.stateLen, static_cast< unsigned long >( items.size() ), stateLen );
+        return 1;
+    }
+    if ( !opt.trace ) {
+        generateTrace( opt, static_cast< int >( items.size() ), stateLen, trace );
+    }
+    if ( opt.record ) {
+        std::ofstream out( opt.record );
+        /// the hierarchy options to replay the trace with
+        out << "# --fanout " << opt.fanout << " --depth " << opt.depth << " --name-length " << opt.nameLength
+            << " --duplicates " << opt.duplicates << " --items " << opt.maxItems << " --seed " << opt.seed << '\n'
+            << "# " << items.size() << " items, " << stateLen << " states\n";
+        for ( std::size_t idx( 0 ); idx < trace.size(); ++idx ) {
+            out << trace[ idx ] << '\n';
+        }
+    }
+
+    Samples resetSamples( "reset" ), itemSamples( "item" ), stateSamples( "state" ), toggleSamples( "toggle" ), toScriptSamples( "to_script" ),
+            fromScriptSamples( "from_script" ), storeSamples( "store" ), getTextSamples( "get_text" );
+    std::string script;
+    DD::Image::OutputContext oc;
+    for ( std::size_t line( 0 ); line < trace.size(); ++line ) {
+        std::istringstream in( trace[ line ] );
+        std::string op;
+        int idx( 0 ), value( 0 );
+        in >> op >> idx >> value;
+
+        double start( nowNanoseconds() );
+        Samples* samples( NULL );
+        if ( op == "reset" ) {
+            std::string states( knob.get_text() );
+            start = nowNanoseconds();
+            knob.reset( itemPtrs.empty() ? NULL : &itemPtrs[ 0 ], static_cast< int >( itemPtrs.size() ), '/', states.c_str(), 1 );
+            resetSamples.values.push_back( nowNanoseconds() - start );
+            collectRows( widget, rows );
+            continue;
+        } else if ( op == "item" ) {
+            knob.setItemState( idx, value );
+            samples = &itemSamples;
+        } else if ( op == "state" ) {
+            knob.setState( idx, value );
+            samples = &stateSamples;
+        } else if ( op == "toggle" ) {
+            if ( idx < 0 || static_cast< std::size_t >( idx ) >= rows.size() || !rows[ idx ] ) {
+                continue;
+            }
+            rows[ idx ]->setCheckState( 0, value ? Qt::Checked : Qt::Unchecked );
+            samples = &toggleSamples;
+        } else if ( op == "to_script" ) {
+            std::ostringstream os;
+            knob.to_script( os, NULL, false );
+            samples = &toScriptSamples;
+            script = os.str();
+        } else if ( op == "from_script" ) {
+            if ( script.empty() ) {
+                continue;
+            }
+            knob.from_script( script.c_str() );
+            samples = &fromScriptSamples;
+        } else if ( op == "store" ) {
+            DD::Image::Hash hash;
+            const char* stored( NULL );
+            knob.store( DD::Image::Custom, &stored, hash, oc );
+            samples = &storeSamples;
+        } else if ( op == "get_text" ) {
+            knob.get_text();
+            samples = &getTextSamples;
+        } else {
+            ::fprintf( stderr, "line %lu: unknown operation '%s'\n", static_cast< unsigned long >( line + 1 ), op.c_str() );
+            return 1;
+        }
+        samples->values.push_back( nowNanoseconds() - start );
+    }
+
+    HierarchyViewKnob::MemoryUsage memory;
+    knob.getMemoryUsage( memory );
+    ::printf( "%lu states, %lu operations, about %lu bytes in use\n", static_cast< unsigned long >( stateLen ),
+              static_cast< unsigned long >( trace.size() ), static_cast< unsigned long >( memory.total ) );
+    Samples* all[] = { &resetSamples, &itemSamples, &stateSamples, &toggleSamples, &toScriptSamples, &fromScriptSamples, &storeSamples, &getTextSamples };
+    for ( std::size_t idx( 0 ); idx < sizeof( all ) / sizeof( all[ 0 ] ); ++idx ) {
+        printHistogram( *all[ idx ] );
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# -----------------------------------------------------------------------------
+# 2009-2013 by Jupiter Jazz Limited.
+#
+# This software, excluded third party dependencies, is released in public domain,
+# see unlicense.txt file for more detail.
+# -----------------------------------------------------------------------------
+
+# Runs the '--check' cases of HierarchyViewKnobBench and exits with 1 if any of
+# them fails, the path of the tool is the first argument:
+#   $ HierarchyViewKnobBench/check.sh ./HierarchyViewKnobBench
+
+bench="${1:-./HierarchyViewKnobBench}"
+failures=0
+
+run()
+{
+    echo "check: $*"
+    if ! "$bench" "$@" --check; then
+        echo "FAILED: $*" >&2
+        failures=$((failures + 1))
+    fi
+}
+
+# a 10k wide flat level
+run --fanout 10000 --depth 1
+# leaf names repeated by the siblings and at different depths
+run --fanout 5 --depth 6 --duplicates 30
+run --fanout 3 --depth 8 --duplicates 100
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures check(s) failed" >&2
+    exit 1
+fi
+echo "all checks passed"
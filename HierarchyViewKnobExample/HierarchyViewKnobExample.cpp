@@ -17,6 +17,7 @@
 #include "HierarchyViewKnob.h"
 
 #include <sstream>
+#include <vector>
 
 using namespace DD::Image;
 
@@ -65,8 +66,18 @@ void HierarchyViewKnobExample::_validate(bool for_real)
     /// retrieve and show the states
     HierarchyViewKnob* hk = ( HierarchyViewKnob* )( knob( "test" ) );
     if ( hk ) {
-        for ( int idx( 0 ); idx < 14; ++idx ) {
-            std::cerr << "item " << items[idx] << " state is " << hk->getItemState( idx ) << std::endl;
+        /// enabled items come as '[ begin, end )' ranges, a reader could skip
+        /// the disabled objects in bulk; the states of the frame being
+        /// rendered, which differ from the current ones when there are keys
+        double frame( outputContext().frame() );
+        std::vector< int > ranges( 2 * hk->getEnabledItemRanges( NULL, 0, frame ) );
+        if ( !ranges.empty() ) {
+            hk->getEnabledItemRanges( &ranges[ 0 ], static_cast< int >( ranges.size() / 2 ), frame );
+        }
+        for ( std::size_t rangeIdx( 0 ); rangeIdx < ranges.size(); rangeIdx += 2 ) {
+            for ( int idx( ranges[ rangeIdx ] ); idx < ranges[ rangeIdx + 1 ]; ++idx ) {
+                std::cerr << "item " << items[idx] << " is enabled" << std::endl;
+            }
         }
     }
 }
@@ -10,27 +10,137 @@
 // -----------------------------------------------------------------------------
 
 #include "HierarchyViewKnob.h"
+#include "HierarchyViewStates.h"
 #include "HierarchyViewWidget.moc.h"
 #include <DDImage/Knob.h>
 
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <map>
+#include <algorithm>
+#include <iterator>
+#include <set>
 #include <string>
 #include <vector>
 
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QMutex>
 #include <QStringBuilder>
 
+/// guessed heap overhead of a QTreeWidgetItem besides the object itself,
+/// the private data and the values vector with the check state;
+/// not measured, it depends on the Qt build
+static const std::size_t kEstimatedItemDataOverhead = 96;
+/// guessed heap overhead of a node of QHash, std::map and std::set, the
+/// links and the allocator header
+static const std::size_t kEstimatedNodeOverhead = 4 * sizeof( void* );
+
+/// heap memory of a string, none if the characters are stored in the string
+/// object itself ( small string optimization ), whatever the cutoff of the
+/// library is, or for the shared empty string of copy-on-write strings
+static inline std::size_t stringMemoryUsage( const std::string& _str )
+{
+    const char* data( _str.data() );
+    const char* object( reinterpret_cast< const char* >( &_str ) );
+    if ( _str.capacity() == 0 || ( data >= object && data < object + sizeof( std::string ) ) ) {
+        return 0;
+    }
+    return _str.capacity() + 1;
+}
+
+static inline std::size_t stringMemoryUsage( const QString& _str )
+{
+    return _str.isNull() ? 0 : ( static_cast< std::size_t >( _str.capacity() ) + 1 ) * sizeof( QChar ) + kEstimatedNodeOverhead;
+}
+
+/// memory of a cached column text with its node in QCache
+static inline std::size_t columnCacheCost( const QString& _text )
+{
+    return kEstimatedNodeOverhead + sizeof( QString ) + stringMemoryUsage( _text );
+}
+
+/// maximum heap bytes of the cached column texts of a widget, the cost of
+/// an entry is its memory, so the cache also reports its own footprint
+static const int kColumnCacheCost = 1 << 20;
+/// size of the buffer passed to the column provider at the first try
+static const int kColumnBufferSize = 256;
+/// the script is written in chunks of this many characters, so that saving
+/// never holds a text copy of the whole states
+static const std::size_t kScriptChunkSize = 4096;
+/// number of sidecar states kept in memory, see sidecarSnapshots_
+static const std::size_t kSidecarSnapshots = 16;
+/// a key every this many holds the full states, the others only their runs
+static const std::size_t kKeyCheckpoint = 32;
+
+////////////////////////////////////////////////////////////////////////////////
+/// HierarchyViewItem
+////////////////////////////////////////////////////////////////////////////////
+
+HierarchyViewItem::HierarchyViewItem( int _absIdx )
+    : QTreeWidgetItem( UserType ), absIdx_( _absIdx ), itemIdx_( -1 )
+{
+}
+
+QVariant HierarchyViewItem::data( int _column, int _role ) const
+{
+    /// HierarchyViewItem is only created by HierarchyViewWidget
+    const HierarchyViewWidget* widget = static_cast< const HierarchyViewWidget* >( treeWidget() );
+    if ( widget && _column == 0 && ( _role == Qt::DisplayRole || _role == Qt::EditRole ) ) {
+        return widget->nameText( this );
+    }
+    if ( widget && _column > 0 && ( _role == Qt::DisplayRole || _role == Qt::ToolTipRole ) ) {
+        return widget->columnText( this, _column );
+    }
+    return QTreeWidgetItem::data( _column, _role );
+}
+
+void HierarchyViewItem::setData( int _column, int _role, const QVariant& _value )
+{
+    /// Qt turns a clicked partially checked item into checked, but for a user
+    /// a partially checked item is enabled, so the click should disable it;
+    /// programmatic changes happen in bulk update and are taken as they are
+    if ( _column == 0 && _role == Qt::CheckStateRole && _value.toInt() == Qt::Checked
+         && checkState( 0 ) == Qt::PartiallyChecked ) {
+        const HierarchyViewWidget* widget = static_cast< const HierarchyViewWidget* >( treeWidget() );
+        if ( widget && !widget->inBulkUpdate() ) {
+            QTreeWidgetItem::setData( _column, _role, static_cast< int >( Qt::Unchecked ) );
+            return;
+        }
+    }
+    QTreeWidgetItem::setData( _column, _role, _value );
+}
+
+bool HierarchyViewItem::operator<( const QTreeWidgetItem& _other ) const
+{
+    int column( treeWidget() ? treeWidget()->sortColumn() : 0 );
+    if ( column <= 0 ) {
+        return QTreeWidgetItem::operator<( _other );
+    }
+
+    /// HierarchyViewItem is only created by HierarchyViewWidget
+    return static_cast< const HierarchyViewWidget* >( treeWidget() )->lessThan( this, &_other, column );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// HierarchyViewWidget
 ////////////////////////////////////////////////////////////////////////////////
 
-HierarchyViewWidget::HierarchyViewWidget( HierarchyViewKnob* _knob ) : knob_( _knob ), absIdxHash_(), idxArray_(), suspendUpdate_( false )
+HierarchyViewWidget::HierarchyViewWidget( HierarchyViewKnob* _knob )
+    : knob_( _knob ), suspendUpdate_( false ),
+      bulkUpdateDepth_( 0 ), signalsBlocked_( false ), modelSignalsBlocked_( false ),
+      columnCB_( NULL ), columnClosure_( NULL ), columnCache_( kColumnCacheCost ),
+      sorting_( false ), sortKeys_()
 {
     setColumnCount( 1 );
     setHeaderLabel( "" );
     knob_->addCB( WidgetCallback, this );
     connect( this, SIGNAL( itemChanged( QTreeWidgetItem*, int ) ), this, SLOT( valueChanged( QTreeWidgetItem*, int ) ) );
+    connect( model(), SIGNAL( layoutAboutToBeChanged() ), this, SLOT( beginSort() ) );
+    connect( model(), SIGNAL( layoutChanged() ), this, SLOT( endSort() ) );
 }
 
 HierarchyViewWidget::~HierarchyViewWidget()
@@ -56,82 +166,204 @@ void HierarchyViewWidget::wheelEvent( QWheelEvent* _event )
     }
 }
 
-bool HierarchyViewWidget::parentItemState( QTreeWidgetItem* parentItem ) const
-{
-    while ( parentItem ) {
-        if ( ! parentItem->checkState( 0 ) ) {
-            return false;
-        }
-        parentItem = parentItem->parent();
-    }
-    return true;
-}
-
 void HierarchyViewWidget::valueChanged( QTreeWidgetItem* _item, int _column )
 {
-    if ( knob_ && getAbsIndex( _item ) >= 0 ) {
+    int absIdx( getAbsIndex( _item ) );
+    if ( knob_ && absIdx >= 0 ) {
+
+        /// observers are notified once for the whole toggle
+        knob_->beginEdit();
 
         /// change item state
         bool state(  _item->checkState( _column ) );
-        knob_->setState( getAbsIndex( _item ), state );
+        knob_->setState( absIdx, state );
 
         /// NOTE: if suspendUpdate == true, there are items added into the widget
         /// so we stop looking for their children items, otherwise the state can
         /// never be correct
         if ( !getSuspendUpdate() ) {
-
-            /// get the full path of current item
-            QString fullPath( _item->text( _column ) );
-            for ( QTreeWidgetItem* parentItem( _item->parent() ); parentItem; parentItem = parentItem->parent() ) {
-                fullPath = parentItem->text( 0 ) % "/" % fullPath;
-            }
-            fullPath = "/" % fullPath;
-
-            const QVector< QPair< QString, QTreeWidgetItem* > >& idxArray( itemIndices() );
-            for ( int idx( 0 ); idx < idxArray.size(); ++idx ) {
-                if ( idxArray[ idx ].first == fullPath ) {
-                    knob_->setItemState( idx, parentItemState( idxArray[ idx ].second ) );
-                } else  if ( idxArray[ idx ].first.startsWith( fullPath % "/" ) ) {
-                    if ( idxArray[ idx ].second && idxArray[ idx ].second->checkState( 0 ) ) {
-                        knob_->setItemState( idx, parentItemState( idxArray[ idx ].second->parent() ) );
-                    }
-                }
-            }
+            /// the original items in the subtree of the item
+            knob_->updateItemStates( absIdx );
         }
+
+        knob_->endEdit();
     }
 }
 
-int HierarchyViewWidget::getAbsIndex( QTreeWidgetItem* _item ) const
+int HierarchyViewWidget::getAbsIndex( const QTreeWidgetItem* _item ) const
 {
-    if ( absIdxHash_.contains( _item ) ) {
-        return absIdxHash_.value( _item );
+    if ( _item && _item->type() == QTreeWidgetItem::UserType ) {
+        return static_cast< const HierarchyViewItem* >( _item )->absIndex();
     }
     return -1;
 }
 
 void HierarchyViewWidget::setAbsIndex( QTreeWidgetItem* _item, int _idx )
 {
-    absIdxHash_.insert( _item, _idx );
+    if ( _item && _item->type() == QTreeWidgetItem::UserType ) {
+        static_cast< HierarchyViewItem* >( _item )->setAbsIndex( _idx );
+    }
+}
+
+bool HierarchyViewWidget::getSuspendUpdate() const
+{
+    return suspendUpdate_;
 }
 
-const QVector< QPair< QString, QTreeWidgetItem* > >& HierarchyViewWidget::itemIndices() const
+void HierarchyViewWidget::setSuspendUpdate( bool _suspendUpdate )
 {
-    return idxArray_;
+    suspendUpdate_ = _suspendUpdate;
 }
 
-QVector< QPair< QString, QTreeWidgetItem* > >& HierarchyViewWidget::itemIndices()
+void HierarchyViewWidget::beginBulkUpdate()
 {
-    return idxArray_;
+    if ( bulkUpdateDepth_++ == 0 ) {
+        signalsBlocked_ = blockSignals( true );
+        modelSignalsBlocked_ = model()->blockSignals( true );
+    }
 }
 
-bool HierarchyViewWidget::getSuspendUpdate() const
+bool HierarchyViewWidget::inBulkUpdate() const
 {
-    return suspendUpdate_;
+    return bulkUpdateDepth_ > 0;
 }
 
-void HierarchyViewWidget::setSuspendUpdate( bool _suspendUpdate )
+void HierarchyViewWidget::endBulkUpdate()
 {
-    suspendUpdate_ = _suspendUpdate;
+    if ( bulkUpdateDepth_ > 0 && --bulkUpdateDepth_ == 0 ) {
+        model()->blockSignals( modelSignalsBlocked_ );
+        blockSignals( signalsBlocked_ );
+        viewport()->update();
+    }
+}
+
+void HierarchyViewWidget::setColumns( const QStringList& _labels, HierarchyViewKnob::ColumnCallback _cb, void* _closure )
+{
+    columnCB_ = _cb;
+    columnClosure_ = _closure;
+    columnCache_.clear();
+    sortKeys_.clear();
+
+    setColumnCount( 1 + _labels.size() );
+    for ( int idx( 0 ); idx < _labels.size(); ++idx ) {
+        headerItem()->setText( idx + 1, _labels.at( idx ) );
+    }
+
+    /// no sort indicator, the items stay in the order they were added until
+    /// a header is clicked
+    header()->setSortIndicator( -1, Qt::AscendingOrder );
+    setSortingEnabled( !_labels.isEmpty() );
+}
+
+QString HierarchyViewWidget::nameText( const QTreeWidgetItem* _item ) const
+{
+    int idx( getAbsIndex( _item ) );
+    const char* name( knob_ && idx >= 0 ? knob_->getName( idx ) : NULL );
+    return name ? QString::fromUtf8( name ) : QString();
+}
+
+QString HierarchyViewWidget::columnText( const QTreeWidgetItem* _item, int _column ) const
+{
+    int idx( getAbsIndex( _item ) );
+    if ( !knob_ || !columnCB_ || idx < 0 ) {
+        return QString();
+    }
+
+    quint64 key( ( quint64( idx ) << 32 ) | quint64( _column ) );
+    QString* text = columnCache_.object( key );
+    if ( text ) {
+        return *text;
+    }
+
+    text = new QString( fetchColumnText( idx, static_cast< const HierarchyViewItem* >( _item )->itemIndex(), _column ) );
+    QString result( *text );
+    columnCache_.insert( key, text, static_cast< int >( columnCacheCost( *text ) ) );
+    return result;
+}
+
+QString HierarchyViewWidget::fetchColumnText( int _idx, int _itemIdx, int _column ) const
+{
+    char buf[ kColumnBufferSize ];
+    int len( columnCB_( columnClosure_, _idx, _itemIdx, _column, buf, kColumnBufferSize ) );
+    if ( len < kColumnBufferSize ) {
+        return len > 0 ? QString::fromUtf8( buf, len ) : QString();
+    }
+
+    /// truncated, try again with the full length
+    std::vector< char > longBuf( static_cast< std::size_t >( len ) + 1 );
+    len = columnCB_( columnClosure_, _idx, _itemIdx, _column, &longBuf[ 0 ], static_cast< int >( longBuf.size() ) );
+    len = std::min( len, static_cast< int >( longBuf.size() ) - 1 );
+    return len > 0 ? QString::fromUtf8( &longBuf[ 0 ], len ) : QString();
+}
+
+HierarchyViewWidget::SortKey HierarchyViewWidget::sortKey( const QTreeWidgetItem* _item, int _column ) const
+{
+    int idx( getAbsIndex( _item ) );
+    if ( sorting_ && idx >= 0 ) {
+        QHash< int, SortKey >::const_iterator keyIt( sortKeys_.constFind( idx ) );
+        if ( keyIt != sortKeys_.constEnd() ) {
+            return keyIt.value();
+        }
+    }
+
+    /// a row already in the LRU is not fetched again, but the rows of a sort
+    /// don't go into it, they would evict the rows being shown
+    SortKey key;
+    quint64 cacheKey( ( quint64( idx ) << 32 ) | quint64( _column ) );
+    if ( idx < 0 || !knob_ || !columnCB_ ) {
+        key.text = _item->data( _column, Qt::DisplayRole ).toString();
+    } else if ( columnCache_.contains( cacheKey ) ) {
+        key.text = *columnCache_.object( cacheKey );
+    } else {
+        key.text = fetchColumnText( idx, static_cast< const HierarchyViewItem* >( _item )->itemIndex(), _column );
+    }
+    key.isNumber = false;
+    key.value = key.text.toDouble( &key.isNumber );
+
+    if ( sorting_ && idx >= 0 ) {
+        sortKeys_.insert( idx, key );
+    }
+    return key;
+}
+
+bool HierarchyViewWidget::lessThan( const QTreeWidgetItem* _lhs, const QTreeWidgetItem* _rhs, int _column ) const
+{
+    /// numbers are compared by value, e.g. vertex count, others as text
+    SortKey lhs( sortKey( _lhs, _column ) );
+    SortKey rhs( sortKey( _rhs, _column ) );
+    if ( lhs.isNumber && rhs.isNumber ) {
+        return lhs.value < rhs.value;
+    }
+    return QString::localeAwareCompare( lhs.text, rhs.text ) < 0;
+}
+
+void HierarchyViewWidget::beginSort()
+{
+    sorting_ = true;
+    sortKeys_.clear();
+}
+
+void HierarchyViewWidget::endSort()
+{
+    sorting_ = false;
+    sortKeys_.clear();
+}
+
+void HierarchyViewWidget::invalidateColumns()
+{
+    columnCache_.clear();
+    sortKeys_.clear();
+}
+
+void HierarchyViewWidget::memoryUsage( std::size_t& _items, std::size_t& _caches ) const
+{
+    _items = 0;
+    for ( QTreeWidgetItemIterator itemIt( const_cast< HierarchyViewWidget* >( this ) ); ( *itemIt ); ++itemIt ) {
+        _items += sizeof( HierarchyViewItem ) + kEstimatedItemDataOverhead;
+    }
+
+    /// the cost of the cache is its memory, object() would reorder the LRU
+    _caches = static_cast< std::size_t >( columnCache_.totalCost() );
 }
 
 void HierarchyViewWidget::update()
@@ -177,6 +409,228 @@ int HierarchyViewWidget::WidgetCallback( void* _closure, DD::Image::Knob::Callba
     return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// HierarchyViewTokenizer
+/// Splits a path into tokens on the raw bytes, the tokens point into the
+/// original string and empty tokens are skipped. The separator is a policy,
+/// the usual ones are compile time constants, '\0' passes the whole path
+/// through as a single token.
+////////////////////////////////////////////////////////////////////////////////
+
+struct HierarchyViewToken
+{
+    const char* data;
+    std::size_t size;
+
+    HierarchyViewToken() : data( NULL ), size( 0 ) {}
+};
+
+template< char SepT >
+struct HierarchyViewSeparator
+{
+    inline bool operator()( char _c ) const { return _c == SepT; }
+    inline bool passThrough() const { return SepT == '\0'; }
+};
+
+struct HierarchyViewAnySeparator
+{
+    char sep;
+    HierarchyViewAnySeparator( char _sep ) : sep( _sep ) {}
+    inline bool operator()( char _c ) const { return _c == sep; }
+    inline bool passThrough() const { return sep == '\0'; }
+};
+
+template< typename SeparatorT >
+class HierarchyViewTokenizer
+{
+public:
+    HierarchyViewTokenizer( const char* _path, const SeparatorT& _sep ) : pos_( _path ), sep_( _sep ), done_( false ) {}
+
+    inline bool next( HierarchyViewToken& _token )
+    {
+        if ( sep_.passThrough() ) {
+            if ( done_ ) {
+                return false;
+            }
+            _token.data = pos_;
+            _token.size = ::strlen( pos_ );
+            done_ = true;
+            return true;
+        }
+
+        while ( *pos_ && sep_( *pos_ ) ) {
+            ++pos_;
+        }
+        if ( !*pos_ ) {
+            return false;
+        }
+        _token.data = pos_;
+        while ( *pos_ && !sep_( *pos_ ) ) {
+            ++pos_;
+        }
+        _token.size = static_cast< std::size_t >( pos_ - _token.data );
+        return true;
+    }
+
+private:
+    const char* pos_;
+    SeparatorT sep_;
+    bool done_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// HierarchyViewSidecar
+/// Binary file holding the states of a knob, used instead of the inline text
+/// for very large hierarchies. Layout in native byte order:
+///   header  : see Header below
+///   payload : words of the flattened states, then words of the item states
+/// The hash is FNV-1a of the sizes and the payload, it is written into the
+/// script as well, so that a reference never loads other states than those
+/// it was written with. There is one file per knob, replaced in place.
+////////////////////////////////////////////////////////////////////////////////
+
+class HierarchyViewSidecar
+{
+public:
+    struct Header {
+        char magic[ 8 ];
+        quint64 hash;
+        quint64 allSize;
+        quint64 itemSize;
+        quint64 payloadSize;
+    };
+
+    static inline void hashAppend( quint64& _hash, const void* _data, std::size_t _len )
+    {
+        const unsigned char* data = static_cast< const unsigned char* >( _data );
+        for ( std::size_t idx( 0 ); idx < _len; ++idx ) {
+            _hash ^= data[ idx ];
+            _hash *= Q_UINT64_C( 1099511628211 );
+        }
+    }
+
+    static inline quint64 hashSeed( quint64 _allSize, quint64 _itemSize )
+    {
+        quint64 hash( Q_UINT64_C( 14695981039346656037 ) );
+        hashAppend( hash, &_allSize, sizeof( _allSize ) );
+        hashAppend( hash, &_itemSize, sizeof( _itemSize ) );
+        return hash;
+    }
+
+    static inline quint64 hash( const HierarchyViewStates& _allStates, const HierarchyViewStates& _itemStates )
+    {
+        quint64 hash( hashSeed( _allStates.size(), _itemStates.size() ) );
+        hashAppend( hash, _allStates.words(), _allStates.wordSize() * sizeof( HierarchyViewStates::WordT ) );
+        hashAppend( hash, _itemStates.words(), _itemStates.wordSize() * sizeof( HierarchyViewStates::WordT ) );
+        return hash;
+    }
+
+    static inline bool write( const QString& _fileName, const HierarchyViewStates& _allStates, const HierarchyViewStates& _itemStates, quint64 _hash )
+    {
+        /// the file already holds these states, nothing to write
+        if ( matches( _fileName, _hash ) ) {
+            return true;
+        }
+
+        /// write into a temporary file first, a failure never leaves a
+        /// truncated sidecar behind
+        QString tmpFileName( _fileName % ".tmp" );
+        QFile file( tmpFileName );
+        if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+            return false;
+        }
+
+        Header header;
+        ::memset( &header, 0, sizeof( header ) );
+        ::memcpy( header.magic, kMagic, sizeof( header.magic ) );
+        header.hash = _hash;
+        header.allSize = _allStates.size();
+        header.itemSize = _itemStates.size();
+        header.payloadSize = ( _allStates.wordSize() + _itemStates.wordSize() ) * sizeof( HierarchyViewStates::WordT );
+
+        bool ok( writeChunk( file, &header, sizeof( header ) ) );
+        ok = ok && writeChunk( file, _allStates.words(), _allStates.wordSize() * sizeof( HierarchyViewStates::WordT ) );
+        ok = ok && writeChunk( file, _itemStates.words(), _itemStates.wordSize() * sizeof( HierarchyViewStates::WordT ) );
+        file.close();
+
+        if ( ok ) {
+            QFile::remove( _fileName );
+            ok = QFile::rename( tmpFileName, _fileName );
+        }
+        if ( !ok ) {
+            QFile::remove( tmpFileName );
+        }
+        return ok;
+    }
+
+    static inline bool read( const QString& _fileName, quint64 _hash, HierarchyViewStates& _allStates, HierarchyViewStates& _itemStates )
+    {
+        QFile file( _fileName );
+        if ( !file.open( QIODevice::ReadOnly ) || file.size() < qint64( sizeof( Header ) ) ) {
+            return false;
+        }
+        qint64 fileSize( file.size() );
+        const uchar* data = file.map( 0, fileSize );
+        if ( !data ) {
+            return false;
+        }
+
+        Header header;
+        ::memcpy( &header, data, sizeof( header ) );
+        quint64 allBytes( ( header.allSize + HierarchyViewStates::kWordBits - 1 ) / HierarchyViewStates::kWordBits * sizeof( HierarchyViewStates::WordT ) );
+        quint64 itemBytes( ( header.itemSize + HierarchyViewStates::kWordBits - 1 ) / HierarchyViewStates::kWordBits * sizeof( HierarchyViewStates::WordT ) );
+        const uchar* payload = data + sizeof( header );
+
+        bool ok( ::memcmp( header.magic, kMagic, sizeof( header.magic ) ) == 0
+                 && header.hash == _hash
+                 && header.payloadSize == quint64( fileSize ) - sizeof( header )
+                 && allBytes + itemBytes == header.payloadSize );
+        if ( ok ) {
+            quint64 hash( hashSeed( header.allSize, header.itemSize ) );
+            hashAppend( hash, payload, static_cast< std::size_t >( header.payloadSize ) );
+            ok = hash == header.hash;
+        }
+        if ( ok ) {
+            _allStates.assignWords( payload, static_cast< std::size_t >( header.allSize ) );
+            _itemStates.assignWords( payload + allBytes, static_cast< std::size_t >( header.itemSize ) );
+        }
+
+        file.unmap( const_cast< uchar* >( data ) );
+        return ok;
+    }
+
+private:
+    /// whether '_fileName' is a complete sidecar of '_hash', only the header
+    /// is read, the payload was verified when it was written
+    static inline bool matches( const QString& _fileName, quint64 _hash )
+    {
+        QFile file( _fileName );
+        if ( !file.open( QIODevice::ReadOnly ) || file.size() < qint64( sizeof( Header ) ) ) {
+            return false;
+        }
+        qint64 fileSize( file.size() );
+        const uchar* data = file.map( 0, sizeof( Header ) );
+        if ( !data ) {
+            return false;
+        }
+        Header header;
+        ::memcpy( &header, data, sizeof( header ) );
+        file.unmap( const_cast< uchar* >( data ) );
+        return ::memcmp( header.magic, kMagic, sizeof( header.magic ) ) == 0
+               && header.hash == _hash
+               && header.payloadSize == quint64( fileSize ) - sizeof( header );
+    }
+
+    static inline bool writeChunk( QFile& _file, const void* _data, std::size_t _len )
+    {
+        return !_len || _file.write( static_cast< const char* >( _data ), static_cast< qint64 >( _len ) ) == static_cast< qint64 >( _len );
+    }
+
+    static const char kMagic[ 8 ];
+};
+
+const char HierarchyViewSidecar::kMagic[ 8 ] = { 'H', 'V', 'K', 'S', 'I', 'D', 'E', '2' };
+
 ////////////////////////////////////////////////////////////////////////////////
 /// HierarchyViewKnobImp
 /// This is the actual implementation of HierarchyViewKnob, this class holds
@@ -189,10 +643,104 @@ class HierarchyViewKnobImp
 {
 public:
     HierarchyViewKnobImp( const char** _data )
-        : widget_( NULL ), items_(), allStatesStr_( "" ), itemStatesStr_( "" ), indexMap_()
+        : widget_( NULL ), items_(), allStates_(), itemStates_(), allStatesStr_( "" ), allStatesStrDirty_( false ),
+          nodeParents_(), itemNodes_(), nodeItems_(), nodeFirstChildren_(), nodeLastChildren_(), nodeNextSiblings_(),
+          firstRootNode_( -1 ), lastRootNode_( -1 ), nodeHashes_(), childTable_(), nodeItemIndices_(), uncheckedDescendants_(), nodeItemRanges_(), itemPositions_(), positionItems_(), subtreeItemStates_(),
+          columnLabels_(), columnCB_( NULL ), columnClosure_( NULL ),
+          observers_(), changedItems_(), changedBegin_( 0 ), changedEnd_( 0 ), editDepth_( 0 ),
+          presets_(), keys_(), keyAllSize_( 0 ), keyItemSize_( 0 ), keyCheckpoints_(), resolvedAllStates_(), resolvedItemStates_(), resolvedKey_( -1 ), keyTexts_(),
+          sidecarBaseDir_(), sidecarPath_(), sidecarSnapshots_()
     {
         if ( _data && (*_data) ) {
-            allStatesStr_ = std::string( *_data );
+            allStates_.parse( *_data, *_data + ::strlen( *_data ), '\0' );
+            allStatesStrDirty_ = true;
+        }
+        QMutexLocker locker( &instancesMutex() );
+        instances().insert( this );
+    }
+
+    ~HierarchyViewKnobImp()
+    {
+        QMutexLocker locker( &instancesMutex() );
+        instances().erase( this );
+    }
+
+    /// all the live instances, for HierarchyViewKnob::getTotalMemoryUsage()
+    static inline std::set< HierarchyViewKnobImp* >& instances()
+    {
+        static std::set< HierarchyViewKnobImp* > s_instances;
+        return s_instances;
+    }
+
+    static inline QMutex& instancesMutex()
+    {
+        static QMutex s_mutex;
+        return s_mutex;
+    }
+
+    template< typename T >
+    static inline std::size_t vectorMemoryUsage( const std::vector< T >& _vec )
+    {
+        return _vec.capacity() * sizeof( T );
+    }
+
+    inline void memoryUsage( HierarchyViewKnob::MemoryUsage& _usage ) const
+    {
+        _usage.hierarchy = vectorMemoryUsage( nodeParents_ ) + vectorMemoryUsage( itemNodes_ ) + vectorMemoryUsage( nodeItems_ )
+                           + vectorMemoryUsage( nodeItemIndices_ ) + vectorMemoryUsage( uncheckedDescendants_ )
+                           + vectorMemoryUsage( nodeItemRanges_ ) + vectorMemoryUsage( itemPositions_ ) + vectorMemoryUsage( positionItems_ )
+                           + vectorMemoryUsage( nodeFirstChildren_ ) + vectorMemoryUsage( nodeLastChildren_ )
+                           + vectorMemoryUsage( nodeNextSiblings_ ) + vectorMemoryUsage( nodeHashes_ ) + vectorMemoryUsage( childTable_ );
+
+        _usage.strings = vectorMemoryUsage( items_ );
+        for ( std::size_t idx( 0 ); idx < items_.size(); ++idx ) {
+            _usage.strings += stringMemoryUsage( items_[ idx ] );
+        }
+
+        _usage.states = allStates_.memoryUsage() + itemStates_.memoryUsage() + stringMemoryUsage( allStatesStr_ ) + vectorMemoryUsage( presets_ );
+        for ( std::size_t idx( 0 ); idx < presets_.size(); ++idx ) {
+            _usage.states += stringMemoryUsage( presets_[ idx ].name ) + presets_[ idx ].allStates.memoryUsage() + presets_[ idx ].itemStates.memoryUsage();
+        }
+        _usage.states += vectorMemoryUsage( sidecarSnapshots_ );
+        for ( std::size_t idx( 0 ); idx < sidecarSnapshots_.size(); ++idx ) {
+            _usage.states += sidecarSnapshots_[ idx ].allStates.memoryUsage() + sidecarSnapshots_[ idx ].itemStates.memoryUsage();
+        }
+        _usage.states += vectorMemoryUsage( keys_ ) + vectorMemoryUsage( keyCheckpoints_ );
+        for ( std::size_t idx( 0 ); idx < keys_.size(); ++idx ) {
+            _usage.states += vectorMemoryUsage( keys_[ idx ].allRuns ) + vectorMemoryUsage( keys_[ idx ].itemRuns );
+        }
+        for ( std::size_t idx( 0 ); idx < keyCheckpoints_.size(); ++idx ) {
+            _usage.states += keyCheckpoints_[ idx ].allStates.memoryUsage() + keyCheckpoints_[ idx ].itemStates.memoryUsage();
+        }
+
+        _usage.widgetItems = 0;
+        _usage.caches = subtreeItemStates_.memoryUsage() + changedItems_.memoryUsage() + vectorMemoryUsage( observers_ )
+                        + resolvedAllStates_.memoryUsage() + resolvedItemStates_.memoryUsage() + vectorMemoryUsage( keyTexts_ );
+        for ( std::size_t idx( 0 ); idx < keyTexts_.size(); ++idx ) {
+            _usage.caches += stringMemoryUsage( keyTexts_[ idx ] );
+        }
+        if ( widget_ ) {
+            std::size_t widgetCaches( 0 );
+            widget_->memoryUsage( _usage.widgetItems, widgetCaches );
+            _usage.caches += widgetCaches;
+        }
+
+        _usage.total = sizeof( *this ) + _usage.hierarchy + _usage.strings + _usage.states + _usage.widgetItems + _usage.caches;
+    }
+
+    static inline void totalMemoryUsage( HierarchyViewKnob::MemoryUsage& _usage )
+    {
+        ::memset( &_usage, 0, sizeof( _usage ) );
+        QMutexLocker locker( &instancesMutex() );
+        for ( std::set< HierarchyViewKnobImp* >::const_iterator it( instances().begin() ); it != instances().end(); ++it ) {
+            HierarchyViewKnob::MemoryUsage usage;
+            ( *it )->memoryUsage( usage );
+            _usage.hierarchy += usage.hierarchy;
+            _usage.strings += usage.strings;
+            _usage.states += usage.states;
+            _usage.widgetItems += usage.widgetItems;
+            _usage.caches += usage.caches;
+            _usage.total += usage.total;
         }
     }
 
@@ -203,79 +751,239 @@ public:
 
     inline void to_script( std::ostream& _os, const DD::Image::OutputContext* _oc, bool _quote) const
     {
-        _os << "[";
-        _os << allStatesStr_.c_str();
-        _os << ",";
-        _os << itemStatesStr_.c_str();
-        _os << "]";
+        /// the states are converted chunk by chunk from the packed words into
+        /// 'buf', peak memory does not depend on the size of the states
+        char buf[ kScriptChunkSize ];
+
+        /// with a context the states of its frame only, as for copying the
+        /// value of one frame
+        if ( _oc && hasKeys() ) {
+            resolveKey( keyIndex( _oc->frame() ) );
+            _os.put( '[' );
+            writeText( _os, resolvedAllStates_, buf );
+            _os.put( ',' );
+            writeText( _os, resolvedItemStates_, buf );
+            _os.put( ']' );
+            return;
+        }
+
+        /// with a sidecar only the reference '[@hash:path]' is written, if the
+        /// sidecar can't be written the states are written inline as usual;
+        /// the file is only rewritten when the states changed
+        quint64 hash( sidecarPath_.empty() ? 0 : HierarchyViewSidecar::hash( allStates_, itemStates_ ) );
+        QString fileName( sidecarPath_.empty() ? QString() : sidecarFileName( sidecarPath_ ) );
+        if ( !fileName.isEmpty() && HierarchyViewSidecar::write( fileName, allStates_, itemStates_, hash ) ) {
+            keepSidecarSnapshot( hash );
+            static const char digits[] = "0123456789abcdef";
+            _os << "[@";
+            for ( int shift( 60 ); shift >= 0; shift -= 4 ) {
+                _os.put( digits[ ( hash >> shift ) & 0xF ] );
+            }
+            _os << ':' << sidecarPath_ << ']';
+        } else {
+            _os.put( '[' );
+            writeText( _os, allStates_, buf );
+            _os.put( ',' );
+            writeText( _os, itemStates_, buf );
+            _os.put( ']' );
+        }
+        writeKeys( _os, buf );
+        writePresets( _os, buf );
+    }
+
+    /// write the states as '0' / '1' characters through '_buf', which holds
+    /// kScriptChunkSize characters
+    static inline void writeText( std::ostream& _os, const HierarchyViewStates& _states, char* _buf )
+    {
+        for ( std::size_t begin( 0 ); begin < _states.size(); begin += kScriptChunkSize ) {
+            std::size_t end( std::min( begin + kScriptChunkSize, _states.size() ) );
+            _states.toText( begin, end, _buf );
+            _os.write( _buf, static_cast< std::streamsize >( end - begin ) );
+        }
+    }
+
+    /// same as writeText() for the hex form, see HierarchyViewStates::appendHex()
+    static inline void writeHex( std::ostream& _os, const HierarchyViewStates& _states, char* _buf )
+    {
+        for ( std::size_t begin( 0 ); begin < _states.hexSize(); begin += kScriptChunkSize ) {
+            std::size_t end( std::min( begin + kScriptChunkSize, _states.hexSize() ) );
+            _states.toHex( begin, end, _buf );
+            _os.write( _buf, static_cast< std::streamsize >( end - begin ) );
+        }
     }
 
     inline bool from_script( const char* _v )
     {
         if ( _v ) {
-            allStatesStr_ = "";
-            itemStatesStr_ = "";
-            std::size_t vLen( ::strlen( _v ) );
+            allStatesStrDirty_ = true;
+            const char* vEnd( _v + ::strlen( _v ) );
             /// NOTE: there is a memory leak and crash here when using QString
             ///       on Windows, a hand-made loop to copy the states seems
             ///       could avoid crashing.
-            std::size_t idx( 0 );
-            while ( idx < vLen ) {
-                if ( _v[ idx ] == ',' ) {
-                    ++idx;
-                    break;
-                }
-                if ( _v[ idx ] == '0' || _v[ idx ] == '1' ) {
-                    allStatesStr_.push_back( _v[ idx ] );
-                }
-                ++idx;
-            }
-            while ( idx < vLen ) {
-                if ( _v[ idx ] == ']' ) {
-                    ++idx;
-                    break;
-                }
-                if ( _v[ idx ] == '0' || _v[ idx ] == '1' ) {
-                    itemStatesStr_.push_back( _v[ idx ] );
-                }
-                ++idx;
+            ///       The states are packed directly into the bitsets, see
+            ///       HierarchyViewStates::parse().
+            bool ok( true );
+            const char* pos( _v );
+            if ( vEnd - _v > 2 && _v[ 0 ] == '[' && _v[ 1 ] == '@' ) {
+                pos = fromSidecar( _v + 2, vEnd, ok );
+            } else {
+                allStates_.clear();
+                itemStates_.clear();
+                allStates_.reserve( static_cast< std::size_t >( vEnd - _v ) );
+                pos = allStates_.parse( _v, vEnd, ',' );
+                pos = itemStates_.parse( pos, vEnd, ']' );
             }
-            return true;
+            pos = parseKeys( pos, vEnd );
+            parsePresets( pos, vEnd );
+            buildSubtreeItemStates();
+            buildUncheckedDescendants();
+            markAllItemsChanged();
+            return ok;
         }
         return false;
     }
 
-    inline void store( DD::Image::StoreType _type, void* _data, DD::Image::Hash& _hash, const DD::Image::OutputContext& _oc )
+    /// load the states from the sidecar referenced by 'hash:path]', returns
+    /// where parsing stopped. The file only holds the states last written,
+    /// older references, e.g. of undo, are resolved from sidecarSnapshots_;
+    /// if neither has the states of the hash the current ones are kept
+    inline const char* fromSidecar( const char* _begin, const char* _end, bool& _ok )
     {
-        if ( !allStatesStr_.empty() ) {
-            _hash.append( allStatesStr_.c_str() );
-        } else {
-            _hash.append( "" );
+        const char* hashEnd( std::find( _begin, _end, ':' ) );
+        const char* pathEnd( std::find( hashEnd, _end, ']' ) );
+        quint64 hash( 0 );
+        for ( const char* p( _begin ); p < hashEnd; ++p ) {
+            hash = ( hash << 4 ) | quint64( *p >= 'a' ? *p - 'a' + 10 : *p - '0' );
         }
-        if ( !itemStatesStr_.empty() ) {
-            _hash.append( itemStatesStr_.c_str() );
-        } else {
-            _hash.append( "" );
+        std::string path( hashEnd == _end ? hashEnd : hashEnd + 1, pathEnd );
+        QString fileName( path.empty() ? QString() : sidecarFileName( path ) );
+        HierarchyViewStates allStates;
+        HierarchyViewStates itemStates;
+        _ok = ( !fileName.isEmpty() && HierarchyViewSidecar::read( fileName, hash, allStates, itemStates ) )
+              || findSidecarSnapshot( hash, allStates, itemStates );
+        if ( _ok ) {
+            allStates_ = allStates;
+            itemStates_ = itemStates;
+            keepSidecarSnapshot( hash );
         }
-        const char** data = ( const char** )( _data );
-        *data = allStatesStr_.c_str();
+        return pathEnd == _end ? pathEnd : pathEnd + 1;
     }
 
-    inline const char* get_text( const DD::Image::OutputContext* _oc ) const
+    /// remember the current states as those of '_hash', the most recent last;
+    /// toggling back and forth moves the known states to the end rather than
+    /// evicting older ones
+    inline void keepSidecarSnapshot( quint64 _hash ) const
     {
-        if ( !allStatesStr_.empty() ) {
-            return allStatesStr_.c_str();
+        if ( !sidecarSnapshots_.empty() && sidecarSnapshots_.back().hash == _hash ) {
+            return;
         }
-        return "";
+        for ( std::size_t idx( 0 ); idx < sidecarSnapshots_.size(); ++idx ) {
+            if ( sidecarSnapshots_[ idx ].hash == _hash ) {
+                std::rotate( sidecarSnapshots_.begin() + idx, sidecarSnapshots_.begin() + idx + 1, sidecarSnapshots_.end() );
+                return;
+            }
+        }
+        if ( sidecarSnapshots_.size() >= kSidecarSnapshots ) {
+            sidecarSnapshots_.erase( sidecarSnapshots_.begin() );
+        }
+        sidecarSnapshots_.push_back( SidecarSnapshot() );
+        sidecarSnapshots_.back().hash = _hash;
+        sidecarSnapshots_.back().allStates = allStates_;
+        sidecarSnapshots_.back().itemStates = itemStates_;
     }
 
-
-#if kDDImageVersionInteger < 70000
-
-    inline WidgetPointer make_widget( HierarchyViewKnob* _k )
+    inline bool findSidecarSnapshot( quint64 _hash, HierarchyViewStates& _allStates, HierarchyViewStates& _itemStates ) const
     {
-        widget_ = new HierarchyViewWidget( _k );
-        return widget_;
+        for ( std::size_t idx( sidecarSnapshots_.size() ); idx > 0; --idx ) {
+            if ( sidecarSnapshots_[ idx - 1 ].hash == _hash ) {
+                _allStates = sidecarSnapshots_[ idx - 1 ].allStates;
+                _itemStates = sidecarSnapshots_[ idx - 1 ].itemStates;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void setSidecar( const char* _baseDir, const char* _path )
+    {
+        sidecarBaseDir_ = _baseDir ? _baseDir : "";
+        sidecarPath_ = _path ? _path : "";
+    }
+
+    /// the sidecar file of '_path', a relative path is relative to the base
+    /// directory; without base directory it is empty, the current directory
+    /// of the application is not a place to rely on
+    inline QString sidecarFileName( const std::string& _path ) const
+    {
+        QString path( QString::fromUtf8( _path.c_str() ) );
+        if ( QDir::isAbsolutePath( path ) ) {
+            return path;
+        }
+        if ( sidecarBaseDir_.empty() ) {
+            return QString();
+        }
+        return QDir( QString::fromUtf8( sidecarBaseDir_.c_str() ) ).filePath( path );
+    }
+
+    inline void store( DD::Image::StoreType _type, void* _data, DD::Image::Hash& _hash, const DD::Image::OutputContext& _oc )
+    {
+        /// hash the packed words rather than the text, the size is appended as
+        /// well since trailing bits of the last word are always zero; with
+        /// keys only the states of the frame are hashed, not the frame, so
+        /// frames of the same states share the cached results
+        const char** data = ( const char** )( _data );
+        if ( hasKeys() ) {
+            int keyIdx( keyIndex( _oc.frame() ) );
+            resolveKey( keyIdx );
+            appendHash( _hash, resolvedAllStates_ );
+            appendHash( _hash, resolvedItemStates_ );
+            *data = keyText( keyIdx ).c_str();
+            return;
+        }
+        appendHash( _hash, allStates_ );
+        appendHash( _hash, itemStates_ );
+        *data = allStatesStr().c_str();
+    }
+
+    inline const char* get_text( const DD::Image::OutputContext* _oc ) const
+    {
+        if ( _oc && hasKeys() ) {
+            return keyText( keyIndex( _oc->frame() ) ).c_str();
+        }
+        if ( !allStates_.empty() ) {
+            return allStatesStr().c_str();
+        }
+        return "";
+    }
+
+    static inline void appendHash( DD::Image::Hash& _hash, const HierarchyViewStates& _states )
+    {
+        _hash.append( static_cast< int >( _states.size() ) );
+        if ( !_states.empty() ) {
+            _hash.append( ( const void* )( _states.words() ), static_cast< int >( _states.wordSize() * sizeof( HierarchyViewStates::WordT ) ) );
+        }
+    }
+
+    /// text form of the flattened states, regenerated lazily after a change,
+    /// get_text() and store() have to return a persistent C string
+    inline const std::string& allStatesStr() const
+    {
+        if ( allStatesStrDirty_ ) {
+            allStatesStr_.clear();
+            allStates_.appendText( allStatesStr_ );
+            allStatesStrDirty_ = false;
+        }
+        return allStatesStr_;
+    }
+
+
+#if kDDImageVersionInteger < 70000
+
+    inline WidgetPointer make_widget( HierarchyViewKnob* _k )
+    {
+        widget_ = new HierarchyViewWidget( _k );
+        applyColumns();
+        return widget_;
     }
 
 #else
@@ -283,6 +991,7 @@ public:
     inline WidgetPointer make_widget( HierarchyViewKnob* _k, const DD::Image::WidgetContext& _context )
     {
         widget_ = new HierarchyViewWidget( _k );
+        applyColumns();
         return widget_;
     }
 
@@ -290,93 +999,1020 @@ public:
 
 public:
 
-    inline void setHeader( const std::string& _text )
+    inline void setHeader( const std::string& _text )
+    {
+        if ( widget_ ) {
+            widget_->setHeaderLabel( QString::fromStdString( _text ) );
+        }
+    }
+
+    inline void setColumns( const char* const* _labels, int _columnLen, HierarchyViewKnob::ColumnCallback _cb, void* _closure )
+    {
+        columnLabels_.clear();
+        for ( int idx( 0 ); _labels && idx < _columnLen; ++idx ) {
+            columnLabels_.append( QString::fromUtf8( _labels[ idx ] ? _labels[ idx ] : "" ) );
+        }
+        columnCB_ = columnLabels_.isEmpty() ? NULL : _cb;
+        columnClosure_ = _closure;
+        applyColumns();
+    }
+
+    inline void applyColumns()
+    {
+        if ( widget_ ) {
+            widget_->setColumns( columnLabels_, columnCB_, columnClosure_ );
+        }
+    }
+
+    inline void invalidateColumns()
+    {
+        if ( widget_ ) {
+            widget_->invalidateColumns();
+        }
+    }
+
+    ///-------------------------------------------------------------------
+
+    /// a named selection, the states of both flattened hierarchy and original
+    /// items, stored as bitsets
+    struct Preset {
+        std::string name;
+        HierarchyViewStates allStates;
+        HierarchyViewStates itemStates;
+    };
+
+    struct SidecarSnapshot {
+        quint64 hash;
+        HierarchyViewStates allStates;
+        HierarchyViewStates itemStates;
+    };
+
+    static inline bool isValidPresetName( const char* _name )
+    {
+        /// the name is written as is into the script, so characters used by
+        /// the format or TCL are not allowed
+        return _name && *_name && !::strpbrk( _name, " \t\r\n{}[]:,;\"\\$" );
+    }
+
+    inline int findPreset( const char* _name ) const
+    {
+        for ( std::size_t idx( 0 ); _name && idx < presets_.size(); ++idx ) {
+            if ( presets_[ idx ].name == _name ) {
+                return static_cast< int >( idx );
+            }
+        }
+        return -1;
+    }
+
+    inline std::size_t presetSize() const
+    {
+        return presets_.size();
+    }
+
+    inline const std::string& presetName( int _idx ) const
+    {
+        /// caller should handle boundary checking
+        return presets_[ static_cast< std::size_t >( _idx ) ].name;
+    }
+
+    inline void savePreset( const char* _name )
+    {
+        int presetIdx( findPreset( _name ) );
+        if ( presetIdx < 0 ) {
+            presetIdx = static_cast< int >( presets_.size() );
+            presets_.push_back( Preset() );
+            presets_.back().name = _name;
+        }
+        presets_[ presetIdx ].allStates = allStates_;
+        presets_[ presetIdx ].itemStates = itemStates_;
+    }
+
+    inline void removePreset( int _idx )
+    {
+        /// caller should handle boundary checking
+        presets_.erase( presets_.begin() + _idx );
+    }
+
+    /// functors for HierarchyViewStates::forEachRange(), applied to the bits
+    /// where a preset differs from the current states
+    struct NodeStateFlipper {
+        HierarchyViewKnobImp* imp;
+        int count;
+        NodeStateFlipper( HierarchyViewKnobImp* _imp ) : imp( _imp ), count( 0 ) {}
+        inline void operator()( std::size_t _begin, std::size_t _end )
+        {
+            for ( std::size_t idx( _begin ); idx < _end; ++idx ) {
+                imp->setState( static_cast< int >( idx ), !imp->allStates_.get( idx ) );
+                ++count;
+            }
+        }
+    };
+
+    struct ItemStateFlipper {
+        HierarchyViewKnobImp* imp;
+        ItemStateFlipper( HierarchyViewKnobImp* _imp ) : imp( _imp ) {}
+        inline void operator()( std::size_t _begin, std::size_t _end )
+        {
+            for ( std::size_t idx( _begin ); idx < _end; ++idx ) {
+                imp->setItemState( static_cast< int >( idx ), !imp->itemStates_.get( idx ) );
+            }
+        }
+    };
+
+    /// whether the preset was saved for a hierarchy of the current size
+    inline bool presetMatchesHierarchy( int _idx ) const
+    {
+        /// caller should handle boundary checking
+        const Preset& preset( presets_[ static_cast< std::size_t >( _idx ) ] );
+        return preset.allStates.size() == allStates_.size() && preset.itemStates.size() == itemStates_.size();
+    }
+
+    /// apply a preset by flipping only the states which differ, returns the
+    /// number of flattened items changed, -1 if the preset was saved for a
+    /// hierarchy of different size
+    inline int applyPreset( int _idx )
+    {
+        /// caller should handle boundary checking
+        if ( !presetMatchesHierarchy( _idx ) ) {
+            return -1;
+        }
+        const Preset& preset( presets_[ static_cast< std::size_t >( _idx ) ] );
+        return applyStates( preset.allStates, preset.itemStates );
+    }
+
+    /// set the current states to '_allStates' and '_itemStates' of the same
+    /// sizes, by flipping only the states which differ
+    inline int applyStates( const HierarchyViewStates& _allStates, const HierarchyViewStates& _itemStates )
+    {
+        HierarchyViewStates allDelta( _allStates );
+        allDelta.xorWith( allStates_ );
+        HierarchyViewStates itemDelta( _itemStates );
+        itemDelta.xorWith( itemStates_ );
+
+        /// the widget rows are updated directly, the item states are already
+        /// known so there is nothing for valueChanged() to do
+        if ( widget_ ) {
+            widget_->beginBulkUpdate();
+        }
+        NodeStateFlipper nodeFlipper( this );
+        allDelta.forEachRange( nodeFlipper );
+        if ( widget_ ) {
+            widget_->endBulkUpdate();
+        }
+        if ( nodeFlipper.count ) {
+            allStatesStrDirty_ = true;
+        }
+
+        ItemStateFlipper itemFlipper( this );
+        itemDelta.forEachRange( itemFlipper );
+
+        return nodeFlipper.count;
+    }
+
+    /// presets follow the states in the script as
+    /// '{name:allSize:allHex:itemSize:itemHex}', the parser of older versions
+    /// stops at ']' and ignores them
+    inline void writePresets( std::ostream& _os, char* _buf ) const
+    {
+        for ( std::size_t idx( 0 ); idx < presets_.size(); ++idx ) {
+            const Preset& preset( presets_[ idx ] );
+            /// sizes go through sprintf(), the locale of the stream may group digits
+            _os << '{' << preset.name;
+            _os.write( _buf, ::sprintf( _buf, ":%lu:", static_cast< unsigned long >( preset.allStates.size() ) ) );
+            writeHex( _os, preset.allStates, _buf );
+            _os.write( _buf, ::sprintf( _buf, ":%lu:", static_cast< unsigned long >( preset.itemStates.size() ) ) );
+            writeHex( _os, preset.itemStates, _buf );
+            _os.put( '}' );
+        }
+    }
+
+    static inline const char* parsePresetStates( const char* _begin, const char* _end, HierarchyViewStates& _states )
+    {
+        /// ':size:hex'
+        if ( !_begin || _begin >= _end || *_begin != ':' ) {
+            return NULL;
+        }
+        char* sizeEnd( NULL );
+        unsigned long size( ::strtoul( _begin + 1, &sizeEnd, 10 ) );
+        if ( sizeEnd == _begin + 1 || sizeEnd >= _end || *sizeEnd != ':' ) {
+            return NULL;
+        }
+        return _states.parseHex( sizeEnd + 1, _end, static_cast< std::size_t >( size ) );
+    }
+
+    inline void parsePresets( const char* _begin, const char* _end )
+    {
+        presets_.clear();
+        const char* pos( _begin );
+        while ( pos < _end ) {
+            pos = std::find( pos, _end, '{' );
+            if ( pos == _end ) {
+                break;
+            }
+            const char* nameEnd( std::find( pos, _end, ':' ) );
+            Preset preset;
+            preset.name.assign( pos + 1, nameEnd );
+            const char* statesEnd( parsePresetStates( nameEnd, _end, preset.allStates ) );
+            statesEnd = parsePresetStates( statesEnd, _end, preset.itemStates );
+            if ( !statesEnd || statesEnd >= _end || *statesEnd != '}' ) {
+                /// skip the broken preset
+                ++pos;
+                continue;
+            }
+            if ( isValidPresetName( preset.name.c_str() ) ) {
+                presets_.push_back( preset );
+            }
+            pos = statesEnd + 1;
+        }
+    }
+
+    ///-------------------------------------------------------------------
+
+    /// a key of the per-frame states, the items flipped relative to the
+    /// states of the previous key, or to all disabled for the first key, as
+    /// sorted '[ begin, end )' runs; a key costs the runs of what changed,
+    /// not the size of the hierarchy
+    struct Keyframe {
+        double frame;
+        std::vector< int > allRuns;
+        std::vector< int > itemRuns;
+    };
+
+    struct KeyframeLess {
+        inline bool operator()( double _frame, const Keyframe& _key ) const { return _frame < _key.frame; }
+        inline bool operator()( const Keyframe& _key, double _frame ) const { return _key.frame < _frame; }
+    };
+
+    /// full states of every kKeyCheckpoint-th key
+    struct KeyCheckpoint {
+        HierarchyViewStates allStates;
+        HierarchyViewStates itemStates;
+    };
+
+    struct RunAppender {
+        std::vector< int >& runs;
+        RunAppender( std::vector< int >& _runs ) : runs( _runs ) {}
+        inline void operator()( std::size_t _begin, std::size_t _end )
+        {
+            runs.push_back( static_cast< int >( _begin ) );
+            runs.push_back( static_cast< int >( _end ) );
+        }
+    };
+
+    /// the runs of the set bits of '_delta'
+    static inline void deltaRuns( const HierarchyViewStates& _delta, std::vector< int >& _runs )
+    {
+        _runs.clear();
+        RunAppender appender( _runs );
+        _delta.forEachRange( appender );
+    }
+
+    static inline void flipRuns( HierarchyViewStates& _states, const std::vector< int >& _runs )
+    {
+        for ( std::size_t idx( 0 ); idx < _runs.size(); idx += 2 ) {
+            _states.flip( static_cast< std::size_t >( _runs[ idx ] ), static_cast< std::size_t >( _runs[ idx + 1 ] ) );
+        }
+    }
+
+    /// whether '_idx' is in one of '_runs', it is if an odd number of run
+    /// bounds are at or before it
+    static inline bool inRuns( const std::vector< int >& _runs, int _idx )
+    {
+        return ( std::upper_bound( _runs.begin(), _runs.end(), _idx ) - _runs.begin() ) % 2 == 1;
+    }
+
+    /// keys apply only to the hierarchy they were set for
+    inline bool hasKeys() const
+    {
+        return !keys_.empty() && keyAllSize_ == allStates_.size() && keyItemSize_ == itemStates_.size();
+    }
+
+    inline std::size_t keySize() const
+    {
+        return keys_.size();
+    }
+
+    inline double keyFrame( int _idx ) const
+    {
+        /// caller should handle boundary checking
+        return keys_[ static_cast< std::size_t >( _idx ) ].frame;
+    }
+
+    /// the key in effect at '_frame', the last one at or before it, the first
+    /// one for the frames before; binary search over the frames of the keys
+    inline int keyIndex( double _frame ) const
+    {
+        std::vector< Keyframe >::const_iterator it( std::upper_bound( keys_.begin(), keys_.end(), _frame, KeyframeLess() ) );
+        return it == keys_.begin() ? 0 : static_cast< int >( it - keys_.begin() ) - 1;
+    }
+
+    /// states at key '_idx', its checkpoint and the runs of at most
+    /// kKeyCheckpoint - 1 keys after it
+    inline void resolveStates( int _idx, HierarchyViewStates& _allStates, HierarchyViewStates& _itemStates ) const
+    {
+        std::size_t keyIdx( static_cast< std::size_t >( _idx ) );
+        const KeyCheckpoint& checkpoint( keyCheckpoints_[ keyIdx / kKeyCheckpoint ] );
+        _allStates = checkpoint.allStates;
+        _itemStates = checkpoint.itemStates;
+        for ( std::size_t idx( keyIdx - keyIdx % kKeyCheckpoint + 1 ); idx <= keyIdx; ++idx ) {
+            flipRuns( _allStates, keys_[ idx ].allRuns );
+            flipRuns( _itemStates, keys_[ idx ].itemRuns );
+        }
+    }
+
+    /// state of the original item '_itemIdx' at key '_idx', only reads
+    inline bool resolveItemState( int _idx, std::size_t _itemIdx ) const
+    {
+        std::size_t keyIdx( static_cast< std::size_t >( _idx ) );
+        bool state( keyCheckpoints_[ keyIdx / kKeyCheckpoint ].itemStates.get( _itemIdx ) );
+        for ( std::size_t idx( keyIdx - keyIdx % kKeyCheckpoint + 1 ); idx <= keyIdx; ++idx ) {
+            state ^= inRuns( keys_[ idx ].itemRuns, static_cast< int >( _itemIdx ) );
+        }
+        return state;
+    }
+
+    /// states at key '_idx' into 'resolvedAllStates_' and 'resolvedItemStates_',
+    /// the keys after the last resolved one up to the next checkpoint and the
+    /// key before it by their runs, so that stepping through the frames costs
+    /// one key, other keys by resolveStates()
+    inline void resolveKey( int _idx ) const
+    {
+        if ( resolvedKey_ >= 0 && resolvedKey_ < _idx && _idx - resolvedKey_ <= _idx % static_cast< int >( kKeyCheckpoint ) ) {
+            for ( int idx( resolvedKey_ + 1 ); idx <= _idx; ++idx ) {
+                flipRuns( resolvedAllStates_, keys_[ idx ].allRuns );
+                flipRuns( resolvedItemStates_, keys_[ idx ].itemRuns );
+            }
+        } else if ( resolvedKey_ >= 0 && resolvedKey_ - 1 == _idx ) {
+            flipRuns( resolvedAllStates_, keys_[ resolvedKey_ ].allRuns );
+            flipRuns( resolvedItemStates_, keys_[ resolvedKey_ ].itemRuns );
+        } else if ( resolvedKey_ != _idx ) {
+            resolveStates( _idx, resolvedAllStates_, resolvedItemStates_ );
+        }
+        resolvedKey_ = _idx;
+    }
+
+    /// text form of the states at key '_idx', one persistent string per key
+    /// as store() and get_text() hand out C strings
+    inline const std::string& keyText( int _idx ) const
+    {
+        std::string& text( keyTexts_[ static_cast< std::size_t >( _idx ) ] );
+        if ( text.empty() && keyAllSize_ > 0 ) {
+            resolveKey( _idx );
+            resolvedAllStates_.appendText( text );
+        }
+        return text;
+    }
+
+    inline void invalidateKeys()
+    {
+        resolvedKey_ = -1;
+        keyTexts_.assign( keys_.size(), std::string() );
+    }
+
+    /// rebuild the checkpoints from the one of key '_keyIdx' on, replaying
+    /// the runs of the keys in between; O( k / kKeyCheckpoint ) copies of the
+    /// states when a key is inserted or removed in the middle
+    inline void buildKeyCheckpoints( std::size_t _keyIdx )
+    {
+        std::size_t first( std::min( _keyIdx / kKeyCheckpoint, keyCheckpoints_.size() ) );
+        HierarchyViewStates allStates;
+        HierarchyViewStates itemStates;
+        std::size_t keyIdx( 0 );
+        if ( first > 0 ) {
+            allStates = keyCheckpoints_[ first - 1 ].allStates;
+            itemStates = keyCheckpoints_[ first - 1 ].itemStates;
+            keyIdx = ( first - 1 ) * kKeyCheckpoint + 1;
+        } else {
+            allStates.assign( keyAllSize_, false );
+            itemStates.assign( keyItemSize_, false );
+        }
+        keyCheckpoints_.resize( first );
+        for ( ; keyIdx < keys_.size(); ++keyIdx ) {
+            flipRuns( allStates, keys_[ keyIdx ].allRuns );
+            flipRuns( itemStates, keys_[ keyIdx ].itemRuns );
+            if ( keyIdx % kKeyCheckpoint == 0 ) {
+                keyCheckpoints_.push_back( KeyCheckpoint() );
+                keyCheckpoints_.back().allStates = allStates;
+                keyCheckpoints_.back().itemStates = itemStates;
+            }
+        }
+    }
+
+    /// record the current states as the key at '_frame', replacing the key
+    /// at the same frame; keys set for another hierarchy are dropped
+    inline void setKey( double _frame )
+    {
+        if ( !keys_.empty() && !hasKeys() ) {
+            keys_.clear();
+            keyCheckpoints_.clear();
+        }
+        keyAllSize_ = allStates_.size();
+        keyItemSize_ = itemStates_.size();
+        std::vector< Keyframe >::iterator it( std::lower_bound( keys_.begin(), keys_.end(), _frame, KeyframeLess() ) );
+        std::size_t keyIdx( static_cast< std::size_t >( it - keys_.begin() ) );
+        bool replace( it != keys_.end() && it->frame == _frame );
+        bool append( !replace && keyIdx == keys_.size() );
+
+        /// the runs of the key and of the key following it change
+        HierarchyViewStates allDelta( allStates_ );
+        HierarchyViewStates itemDelta( itemStates_ );
+        if ( keyIdx > 0 ) {
+            resolveKey( static_cast< int >( keyIdx ) - 1 );
+            allDelta.xorWith( resolvedAllStates_ );
+            itemDelta.xorWith( resolvedItemStates_ );
+        }
+        std::size_t nextIdx( replace ? keyIdx + 1 : keyIdx );
+        Keyframe next;
+        if ( nextIdx < keys_.size() ) {
+            resolveKey( static_cast< int >( nextIdx ) );
+            HierarchyViewStates delta( resolvedAllStates_ );
+            delta.xorWith( allStates_ );
+            deltaRuns( delta, next.allRuns );
+            delta = resolvedItemStates_;
+            delta.xorWith( itemStates_ );
+            deltaRuns( delta, next.itemRuns );
+        }
+
+        if ( !replace ) {
+            it = keys_.insert( it, Keyframe() );
+            it->frame = _frame;
+        }
+        deltaRuns( allDelta, it->allRuns );
+        deltaRuns( itemDelta, it->itemRuns );
+        if ( keyIdx + 1 < keys_.size() ) {
+            keys_[ keyIdx + 1 ].allRuns.swap( next.allRuns );
+            keys_[ keyIdx + 1 ].itemRuns.swap( next.itemRuns );
+        }
+
+        /// replacing or appending a key changes the states of this key only,
+        /// which are the current ones
+        if ( replace || append ) {
+            if ( keyIdx % kKeyCheckpoint == 0 ) {
+                keyCheckpoints_.resize( std::max( keyCheckpoints_.size(), keyIdx / kKeyCheckpoint + 1 ) );
+                keyCheckpoints_[ keyIdx / kKeyCheckpoint ].allStates = allStates_;
+                keyCheckpoints_[ keyIdx / kKeyCheckpoint ].itemStates = itemStates_;
+            }
+        } else {
+            buildKeyCheckpoints( keyIdx );
+        }
+        invalidateKeys();
+    }
+
+    inline void removeKey( int _idx )
+    {
+        /// caller should handle boundary checking, the following key takes
+        /// over the runs of the removed one; the runs of the xor of two keys
+        /// are bounded where exactly one of them is
+        std::size_t keyIdx( static_cast< std::size_t >( _idx ) );
+        if ( keyIdx + 1 < keys_.size() ) {
+            Keyframe& key( keys_[ keyIdx ] );
+            Keyframe& next( keys_[ keyIdx + 1 ] );
+            std::vector< int > runs;
+            std::set_symmetric_difference( key.allRuns.begin(), key.allRuns.end(), next.allRuns.begin(), next.allRuns.end(), std::back_inserter( runs ) );
+            next.allRuns.swap( runs );
+            runs.clear();
+            std::set_symmetric_difference( key.itemRuns.begin(), key.itemRuns.end(), next.itemRuns.begin(), next.itemRuns.end(), std::back_inserter( runs ) );
+            next.itemRuns.swap( runs );
+        }
+        keys_.erase( keys_.begin() + _idx );
+        buildKeyCheckpoints( keyIdx );
+        invalidateKeys();
+    }
+
+    inline int findKey( double _frame ) const
+    {
+        std::vector< Keyframe >::const_iterator it( std::lower_bound( keys_.begin(), keys_.end(), _frame, KeyframeLess() ) );
+        return it != keys_.end() && it->frame == _frame ? static_cast< int >( it - keys_.begin() ) : -1;
+    }
+
+    /// set the current states to those at '_frame', returns the number of
+    /// flattened items changed, -1 if there is no key for this hierarchy
+    inline int applyFrame( double _frame )
+    {
+        if ( !hasKeys() ) {
+            return -1;
+        }
+        resolveKey( keyIndex( _frame ) );
+        /// applyStates() changes the current states only, copies keep the
+        /// resolved ones safe from the observers calling back into the knob
+        HierarchyViewStates allStates( resolvedAllStates_ );
+        HierarchyViewStates itemStates( resolvedItemStates_ );
+        return applyStates( allStates, itemStates );
+    }
+
+    /// keys follow the states in the script as
+    /// '<frame:allSize:allRuns:itemSize:itemRuns>', before the presets, the
+    /// runs as 'begin-end' separated by ','; the frame goes through
+    /// QByteArray, which ignores the locale, '%g' of sprintf() would write a
+    /// ',' in some of them
+    inline void writeKeys( std::ostream& _os, char* _buf ) const
+    {
+        for ( std::size_t idx( 0 ); idx < keys_.size(); ++idx ) {
+            const Keyframe& key( keys_[ idx ] );
+            QByteArray frame( QByteArray::number( key.frame, 'g', 17 ) );
+            _os.put( '<' );
+            _os.write( frame.constData(), frame.size() );
+            _os.write( _buf, ::sprintf( _buf, ":%lu:", static_cast< unsigned long >( keyAllSize_ ) ) );
+            writeRuns( _os, key.allRuns, _buf );
+            _os.write( _buf, ::sprintf( _buf, ":%lu:", static_cast< unsigned long >( keyItemSize_ ) ) );
+            writeRuns( _os, key.itemRuns, _buf );
+            _os.put( '>' );
+        }
+    }
+
+    static inline void writeRuns( std::ostream& _os, const std::vector< int >& _runs, char* _buf )
+    {
+        for ( std::size_t idx( 0 ); idx < _runs.size(); idx += 2 ) {
+            _os.write( _buf, ::sprintf( _buf, idx ? ",%d-%d" : "%d-%d", _runs[ idx ], _runs[ idx + 1 ] ) );
+        }
+    }
+
+    /// ':size:runs' of a key into '_runs', returns where parsing stopped or
+    /// NULL; the runs must be ascending and within the size, touching runs are
+    /// merged. A field without '-' is the hex form of the states written
+    /// before the keys were stored as runs
+    static inline const char* parseKeyRuns( const char* _begin, const char* _end, std::size_t& _size, std::vector< int >& _runs )
+    {
+        if ( !_begin || _begin >= _end || *_begin != ':' ) {
+            return NULL;
+        }
+        char* sizeEnd( NULL );
+        unsigned long size( ::strtoul( _begin + 1, &sizeEnd, 10 ) );
+        if ( sizeEnd == _begin + 1 || sizeEnd >= _end || *sizeEnd != ':' || size > static_cast< unsigned long >( INT_MAX ) ) {
+            return NULL;
+        }
+        _size = static_cast< std::size_t >( size );
+        const char* pos( sizeEnd + 1 );
+        const char* fieldEnd( std::find( pos, _end, '>' ) );
+        fieldEnd = std::find( pos, fieldEnd, ':' );
+        _runs.clear();
+        if ( pos < fieldEnd && std::find( pos, fieldEnd, '-' ) == fieldEnd ) {
+            HierarchyViewStates states;
+            const char* hexEnd( states.parseHex( pos, fieldEnd, _size ) );
+            if ( hexEnd ) {
+                deltaRuns( states, _runs );
+            }
+            return hexEnd;
+        }
+        while ( pos < fieldEnd ) {
+            char* numEnd( NULL );
+            long begin( ::strtol( pos, &numEnd, 10 ) );
+            if ( numEnd == pos || numEnd >= fieldEnd || *numEnd != '-' ) {
+                return NULL;
+            }
+            pos = numEnd + 1;
+            long end( ::strtol( pos, &numEnd, 10 ) );
+            if ( numEnd == pos || numEnd > fieldEnd || begin < ( _runs.empty() ? 0 : _runs.back() ) || end <= begin || end > static_cast< long >( size ) ) {
+                return NULL;
+            }
+            if ( !_runs.empty() && _runs.back() == begin ) {
+                _runs.back() = static_cast< int >( end );
+            } else {
+                _runs.push_back( static_cast< int >( begin ) );
+                _runs.push_back( static_cast< int >( end ) );
+            }
+            pos = numEnd;
+            if ( pos < fieldEnd && *pos++ != ',' ) {
+                return NULL;
+            }
+        }
+        return fieldEnd;
+    }
+
+    /// parse the keys up to the first preset, returns where parsing stopped;
+    /// keys out of order or of another size than the first are skipped
+    inline const char* parseKeys( const char* _begin, const char* _end )
+    {
+        keys_.clear();
+        keyAllSize_ = 0;
+        keyItemSize_ = 0;
+        const char* keysEnd( std::find( _begin, _end, '{' ) );
+        const char* pos( _begin );
+        while ( pos < keysEnd && *pos == '<' ) {
+            const char* frameEnd( std::find( pos + 1, keysEnd, ':' ) );
+            bool ok( false );
+            Keyframe key;
+            key.frame = QByteArray( pos + 1, static_cast< int >( frameEnd - pos - 1 ) ).toDouble( &ok );
+            std::size_t allSize( 0 );
+            std::size_t itemSize( 0 );
+            const char* statesEnd( ok ? parseKeyRuns( frameEnd, keysEnd, allSize, key.allRuns ) : NULL );
+            statesEnd = parseKeyRuns( statesEnd, keysEnd, itemSize, key.itemRuns );
+            if ( !statesEnd || statesEnd >= keysEnd || *statesEnd != '>' ) {
+                break;
+            }
+            if ( keys_.empty() ) {
+                keyAllSize_ = allSize;
+                keyItemSize_ = itemSize;
+            }
+            if ( keys_.empty() || ( key.frame > keys_.back().frame && allSize == keyAllSize_ && itemSize == keyItemSize_ ) ) {
+                keys_.push_back( key );
+            }
+            pos = statesEnd + 1;
+        }
+        buildKeyCheckpoints( 0 );
+        invalidateKeys();
+        return pos;
+    }
+
+    /// frame-aware queries over the states of original items, the states of
+    /// the key in effect at '_frame', or the current states without keys;
+    /// they only read, like the queries of the current states
+    inline int itemStateAt( int _idx, double _frame ) const
+    {
+        /// caller should handle boundary checking
+        if ( !hasKeys() ) {
+            return getItemState( _idx );
+        }
+        return resolveItemState( keyIndex( _frame ), static_cast< std::size_t >( _idx ) );
+    }
+
+    inline std::size_t countEnabledAt( double _frame ) const
+    {
+        if ( !hasKeys() ) {
+            return countEnabled();
+        }
+        HierarchyViewStates allStates, itemStates;
+        resolveStates( keyIndex( _frame ), allStates, itemStates );
+        return itemStates.count();
+    }
+
+    inline int enabledItemRangesAt( int* _ranges, int _maxRanges, double _frame ) const
+    {
+        if ( !hasKeys() ) {
+            return enabledItemRanges( _ranges, _maxRanges );
+        }
+        HierarchyViewStates allStates, itemStates;
+        resolveStates( keyIndex( _frame ), allStates, itemStates );
+        RangeWriter writer( _ranges, _maxRanges );
+        itemStates.forEachRange( writer );
+        return writer.count;
+    }
+
+    ///-------------------------------------------------------------------
+
+    inline void addObserver( HierarchyViewKnob::ObserverCallback _cb, void* _closure )
+    {
+        observers_.push_back( std::make_pair( _cb, _closure ) );
+    }
+
+    inline void removeObserver( HierarchyViewKnob::ObserverCallback _cb, void* _closure )
+    {
+        observers_.erase( std::remove( observers_.begin(), observers_.end(), std::make_pair( _cb, _closure ) ), observers_.end() );
+    }
+
+    /// the outermost edit holds a bulk update of the widget, so that the rows
+    /// are redrawn once for the whole edit; returns whether it is outermost
+    inline bool beginEdit()
+    {
+        if ( editDepth_++ > 0 ) {
+            return false;
+        }
+        if ( widget_ ) {
+            widget_->beginBulkUpdate();
+        }
+        return true;
+    }
+
+    /// returns whether the outermost edit ended
+    inline bool endEdit()
+    {
+        if ( editDepth_ <= 0 || --editDepth_ > 0 ) {
+            return false;
+        }
+        if ( widget_ ) {
+            widget_->endBulkUpdate();
+        }
+        return true;
+    }
+
+    inline void markItemChanged( int _idx )
+    {
+        if ( changedItems_.size() != itemStates_.size() ) {
+            changedItems_.assign( itemStates_.size(), false );
+            changedBegin_ = changedEnd_ = 0;
+        }
+        std::size_t idx( static_cast< std::size_t >( _idx ) );
+        changedItems_.set( idx, true );
+        if ( changedBegin_ >= changedEnd_ ) {
+            changedBegin_ = idx;
+            changedEnd_ = idx + 1;
+        } else {
+            changedBegin_ = std::min( changedBegin_, idx );
+            changedEnd_ = std::max( changedEnd_, idx + 1 );
+        }
+    }
+
+    inline void markAllItemsChanged()
+    {
+        changedItems_.assign( itemStates_.size(), true );
+        changedBegin_ = 0;
+        changedEnd_ = itemStates_.size();
+    }
+
+    /// report the changed items to the observers as coalesced ranges, unless
+    /// inside beginEdit() / endEdit(); only the span of the changed items is
+    /// scanned and cleared, so a single change costs O( 1 ) words
+    inline void notifyObservers()
+    {
+        if ( editDepth_ > 0 || changedBegin_ >= changedEnd_ ) {
+            return;
+        }
+
+        std::vector< int > ranges;
+        std::size_t end( std::min( changedEnd_, changedItems_.size() ) );
+        for ( std::size_t begin( changedItems_.findNext( changedBegin_, true ) ); begin < end; begin = changedItems_.findNext( begin, true ) ) {
+            ranges.push_back( static_cast< int >( begin ) );
+            begin = std::min( changedItems_.findNext( begin, false ), end );
+            ranges.push_back( static_cast< int >( begin ) );
+        }
+        if ( changedEnd_ - changedBegin_ >= changedItems_.size() / 2 ) {
+            changedItems_.assign( itemStates_.size(), false );
+        } else {
+            for ( std::size_t idx( 0 ); idx < ranges.size(); idx += 2 ) {
+                for ( int itemIdx( ranges[ idx ] ); itemIdx < ranges[ idx + 1 ]; ++itemIdx ) {
+                    changedItems_.set( static_cast< std::size_t >( itemIdx ), false );
+                }
+            }
+        }
+        changedBegin_ = changedEnd_ = 0;
+
+        if ( ranges.empty() || observers_.empty() ) {
+            return;
+        }
+        /// an observer may remove itself in the callback
+        std::vector< std::pair< HierarchyViewKnob::ObserverCallback, void* > > observers( observers_ );
+        for ( std::size_t idx( 0 ); idx < observers.size(); ++idx ) {
+            observers[ idx ].first( observers[ idx ].second, &ranges[ 0 ], static_cast< int >( ranges.size() / 2 ) );
+        }
+    }
+
+    inline std::size_t itemSize()
+    {
+        /// items_.size() should be equal to allStates_.size() !!
+        return items_.size();
+    }
+
+    inline std::size_t statesSize()
+    {
+        return allStates_.size();
+    }
+
+    inline std::size_t itemStatesSize()
+    {
+        return itemStates_.size();
+    }
+
+    inline bool hasItem( const std::string&  _fullPath ) const
+    {
+        return itemIndex( _fullPath ) >= 0;
+    }
+
+    /// the node of a '/' joined full path, walking down the child hash one
+    /// name at a time
+    inline int itemIndex( const std::string& _fullPath ) const
+    {
+        int nodeIdx( -1 );
+        std::size_t begin( 0 );
+        while ( begin < _fullPath.size() && _fullPath[ begin ] == '/' ) {
+            std::size_t end( _fullPath.find( '/', begin + 1 ) );
+            if ( end == std::string::npos ) {
+                end = _fullPath.size();
+            }
+            HierarchyViewToken name;
+            name.data = _fullPath.data() + begin + 1;
+            name.size = end - begin - 1;
+            nodeIdx = findChild( nodeIdx, name, childHash( nodeIdx, name ) );
+            if ( nodeIdx < 0 ) {
+                return -1;
+            }
+            begin = end;
+        }
+        return begin == _fullPath.size() ? nodeIdx : -1;
+    }
+
+    inline const std::string& itemName( int _idx ) const
+    {
+        /// caller should handle boundary checking
+        return items_[ static_cast< std::size_t >( _idx ) ];
+    }
+
+    ///-------------------------------------------------------------------
+
+    inline void setState( int _idx, int _v )
     {
+        /// caller should handle boundary checking
+        std::size_t idx( static_cast< std::size_t >( _idx ) );
+        bool state( _v );
+        bool changed( allStates_.get( idx ) != state );
+        allStates_.set( idx, state );
+        allStatesStrDirty_ = true;
+
+        if ( idx >= uncheckedDescendants_.size() ) {
+            return;
+        }
+
+        /// update the counters along the ancestor chain, only the rows whose
+        /// counter becomes zero or non-zero have to be redrawn
         if ( widget_ ) {
-            widget_->setHeaderLabel( QString::fromStdString( _text ) );
+            widget_->beginBulkUpdate();
+        }
+        if ( changed ) {
+            int delta( state ? -1 : 1 );
+            for ( int parentIdx( nodeParents_[ idx ] ); parentIdx >= 0; parentIdx = nodeParents_[ parentIdx ] ) {
+                bool wasMixed( uncheckedDescendants_[ parentIdx ] > 0 );
+                uncheckedDescendants_[ parentIdx ] += delta;
+                if ( wasMixed != ( uncheckedDescendants_[ parentIdx ] > 0 ) ) {
+                    updateCheckState( parentIdx );
+                }
+            }
+        }
+        updateCheckState( _idx );
+        if ( widget_ ) {
+            widget_->endBulkUpdate();
         }
     }
 
-    inline std::size_t itemSize()
+    /// check state shown for a node, partially checked if it is enabled but
+    /// any node below it is not
+    inline Qt::CheckState checkState( int _idx ) const
     {
-        /// items_.size() should be equal to allStatesStr_.size() !!
-        return items_.size();
+        std::size_t idx( static_cast< std::size_t >( _idx ) );
+        if ( !allStates_.get( idx ) ) {
+            return Qt::Unchecked;
+        }
+        return idx < uncheckedDescendants_.size() && uncheckedDescendants_[ idx ] > 0 ? Qt::PartiallyChecked : Qt::Checked;
     }
 
-    inline std::size_t statesSize()
+    inline void updateCheckState( int _idx )
     {
-        return allStatesStr_.size();
+        if ( static_cast< std::size_t >( _idx ) < nodeItems_.size() ) {
+            Qt::CheckState state( checkState( _idx ) );
+            if ( nodeItems_[ _idx ]->checkState( 0 ) != state ) {
+                nodeItems_[ _idx ]->setCheckState( 0, state );
+            }
+        }
     }
 
-    inline std::size_t itemStatesSize()
+    /// count the disabled nodes below every node, children are always created
+    /// after their parent, so one backward pass is enough
+    inline void buildUncheckedDescendants()
     {
-        return itemStatesStr_.size();
+        uncheckedDescendants_.assign( nodeParents_.size(), 0 );
+        if ( allStates_.size() != nodeParents_.size() ) {
+            uncheckedDescendants_.clear();
+            return;
+        }
+        for ( int idx( static_cast< int >( nodeParents_.size() ) - 1 ); idx >= 0; --idx ) {
+            if ( nodeParents_[ idx ] >= 0 ) {
+                uncheckedDescendants_[ nodeParents_[ idx ] ] += uncheckedDescendants_[ idx ] + ( allStates_.get( idx ) ? 0 : 1 );
+            }
+        }
     }
 
-    inline bool hasItem( const std::string&  _fullPath ) const
+    inline int getState( int _idx ) const
     {
-        return _fullPath.size() && indexMap_.find( _fullPath ) != indexMap_.end();
+        /// caller should handle boundary checking
+        return allStates_.get( static_cast< std::size_t >( _idx ) );
     }
 
-    inline int itemIndex( const std::string& _fullPath ) const
+    inline void setItemState( int _idx, int _v )
     {
-        if ( hasItem( _fullPath ) ) {
-#if defined( _MSC_VER ) && ( _MSC_VER <= 1600 )
-            return indexMap_.find( _fullPath )->second;
-#else
-            return indexMap_.at( _fullPath );
-#endif
+        /// caller should handle boundary checking
+        if ( itemStates_.get( static_cast< std::size_t >( _idx ) ) != bool( _v ) ) {
+            markItemChanged( _idx );
+        }
+        itemStates_.set( static_cast< std::size_t >( _idx ), bool( _v ) );
+        if ( static_cast< std::size_t >( _idx ) < itemPositions_.size() && itemPositions_[ _idx ] >= 0
+             && static_cast< std::size_t >( itemPositions_[ _idx ] ) < subtreeItemStates_.size() ) {
+            subtreeItemStates_.set( static_cast< std::size_t >( itemPositions_[ _idx ] ), bool( _v ) );
         }
-        return -1;
     }
 
-    inline const std::string& itemName( int _idx ) const
+    inline int getItemState( int _idx ) const
     {
         /// caller should handle boundary checking
-        return items_[ static_cast< std::size_t >( _idx ) ].first;
+        return itemStates_.get( static_cast< std::size_t >( _idx ) );
     }
 
-    inline const std::string& itemPath( int _idx ) const
+    /// after the state of node '_idx' changed: the original items of the node
+    /// are enabled if the node and all its ancestors are, those further down
+    /// are updated the same way if their own node is enabled, the others are
+    /// disabled already; the items are found through the subtree range of the
+    /// node, not by their paths
+    inline void updateItemStates( int _idx )
     {
-        /// caller should handle boundary checking
-        return items_[ static_cast< std::size_t >( _idx ) ].second;
+        /// the states may be shorter than the hierarchy, e.g. after undo of
+        /// reset() or a missing sidecar, then there is nothing to update
+        if ( static_cast< std::size_t >( _idx ) >= nodeItemRanges_.size() || !statesMatchHierarchy() ) {
+            return;
+        }
+        bool enabled( true );
+        for ( int nodeIdx( _idx ); enabled && nodeIdx >= 0; nodeIdx = nodeParents_[ nodeIdx ] ) {
+            enabled = allStates_.get( static_cast< std::size_t >( nodeIdx ) );
+        }
+        for ( int pos( nodeItemRanges_[ _idx ].first ); pos < nodeItemRanges_[ _idx ].second; ++pos ) {
+            int itemIdx( positionItems_[ pos ] );
+            int nodeIdx( itemNodes_[ itemIdx ] );
+            if ( nodeIdx == _idx ) {
+                setItemState( itemIdx, enabled );
+            } else if ( allStates_.get( static_cast< std::size_t >( nodeIdx ) ) ) {
+                bool state( enabled );
+                for ( int parentIdx( nodeParents_[ nodeIdx ] ); state && parentIdx != _idx; parentIdx = nodeParents_[ parentIdx ] ) {
+                    state = allStates_.get( static_cast< std::size_t >( parentIdx ) );
+                }
+                setItemState( itemIdx, state );
+            }
+        }
+    }
+
+    /// whether the states cover the hierarchy built by reset()
+    inline bool statesMatchHierarchy() const
+    {
+        return allStates_.size() == nodeParents_.size() && itemStates_.size() == itemNodes_.size();
     }
 
     ///-------------------------------------------------------------------
 
-    inline void setState( int _idx, int _v )
+    inline std::size_t nodeSize() const
     {
-        /// caller should handle boundary checking
-        allStatesStr_[ static_cast< std::size_t >( _idx ) ] = ( bool( _v ) ? '1' : '0' ) ;
+        return nodeItemRanges_.size();
     }
 
-    inline int getState( int _idx ) const
+    inline int itemIndex( int _idx ) const
     {
         /// caller should handle boundary checking
-        return ( allStatesStr_[ static_cast< std::size_t >( _idx ) ] != '0' ) ;
+        return nodeItemIndices_[ static_cast< std::size_t >( _idx ) ];
     }
 
-    inline void setItemState( int _idx, int _v )
+    inline const char* name( int _idx ) const
     {
         /// caller should handle boundary checking
-        itemStatesStr_[ static_cast< std::size_t >( _idx ) ] = ( bool( _v ) ? '1' : '0' ) ;
+        return items_[ static_cast< std::size_t >( _idx ) ].c_str();
     }
 
-    inline int getItemState( int _idx ) const
+    inline std::size_t countEnabled() const
+    {
+        return itemStates_.count();
+    }
+
+    /// functor for HierarchyViewStates::forEachRange(), writes as many
+    /// ranges as fit into the buffer and counts all of them
+    struct RangeWriter {
+        int* ranges;
+        int maxRanges;
+        int count;
+        RangeWriter( int* _ranges, int _maxRanges ) : ranges( _ranges ), maxRanges( _maxRanges ), count( 0 ) {}
+        inline void operator()( std::size_t _begin, std::size_t _end )
+        {
+            if ( ranges && count < maxRanges ) {
+                ranges[ 2 * count ] = static_cast< int >( _begin );
+                ranges[ 2 * count + 1 ] = static_cast< int >( _end );
+            }
+            ++count;
+        }
+    };
+
+    inline int enabledItemRanges( int* _ranges, int _maxRanges ) const
+    {
+        RangeWriter writer( _ranges, _maxRanges );
+        itemStates_.forEachRange( writer );
+        return writer.count;
+    }
+
+    inline std::size_t countEnabledInSubtree( int _idx ) const
     {
         /// caller should handle boundary checking
-        return ( itemStatesStr_[ static_cast< std::size_t >( _idx ) ] != '0' ) ;
+        const std::pair< int, int >& range( nodeItemRanges_[ static_cast< std::size_t >( _idx ) ] );
+        return subtreeItemStates_.count( static_cast< std::size_t >( range.first ), static_cast< std::size_t >( range.second ) );
     }
 
     inline void clear()
     {
         items_.clear();
+        allStates_.clear();
+        itemStates_.clear();
         allStatesStr_.clear();
-        itemStatesStr_.clear();
-        indexMap_.clear();
+        allStatesStrDirty_ = false;
+        nodeParents_.clear();
+        nodeItems_.clear();
+        nodeFirstChildren_.clear();
+        nodeLastChildren_.clear();
+        nodeNextSiblings_.clear();
+        firstRootNode_ = -1;
+        lastRootNode_ = -1;
+        nodeHashes_.clear();
+        childTable_.clear();
+        itemNodes_.clear();
+        nodeItemIndices_.clear();
+        uncheckedDescendants_.clear();
+        nodeItemRanges_.clear();
+        itemPositions_.clear();
+        positionItems_.clear();
+        subtreeItemStates_.clear();
 
         if ( widget_ ) {
             widget_->clear();
+            widget_->invalidateColumns();
         }
     }
 
@@ -390,45 +2026,148 @@ public:
         _parent->addChild( _item );
     }
 
-    template< typename ParentItemT, typename SiblingT >
-    inline QTreeWidgetItem* createWidgetItem( ParentItemT _parent, SiblingT _sibling, const QString& _name, const std::string& _fullPath, int _stateLen, const std::string& _states, int _defaultState )
+    /// FNV-1a of the name, seeded with the parent so that the same name
+    /// under different parents spreads over the table
+    static inline quint32 childHash( int _parentIdx, const HierarchyViewToken& _name )
+    {
+        quint32 hash( 2166136261u ^ static_cast< quint32 >( _parentIdx + 1 ) * 2654435761u );
+        for ( std::size_t idx( 0 ); idx < _name.size; ++idx ) {
+            hash = ( hash ^ static_cast< unsigned char >( _name.data[ idx ] ) ) * 16777619u;
+        }
+        return hash;
+    }
+
+    /// the direct child of '_parentIdx' named '_name', -1 if none; the hash
+    /// of the children of all the nodes is a single open addressing table of
+    /// node indices keyed by parent and name, probing never leaves the
+    /// children of '_parentIdx'
+    inline int findChild( int _parentIdx, const HierarchyViewToken& _name, quint32 _hash ) const
     {
-        QTreeWidgetItem* item = NULL;
-        /// check if item already been created
-        if ( _sibling ) {
-            for ( QTreeWidgetItemIterator itemIt( _sibling ); ( *itemIt ); ++itemIt ) {
-                if ( ( *itemIt )->text( 0 ) == _name ) {
-                    item = ( *itemIt );
+        if ( childTable_.empty() ) {
+            return -1;
+        }
+        std::size_t mask( childTable_.size() - 1 );
+        for ( std::size_t slot( _hash & mask ); childTable_[ slot ] >= 0; slot = ( slot + 1 ) & mask ) {
+            int nodeIdx( childTable_[ slot ] );
+            if ( nodeHashes_[ nodeIdx ] == _hash && nodeParents_[ nodeIdx ] == _parentIdx ) {
+                const std::string& name( items_[ nodeIdx ] );
+                if ( name.size() == _name.size && !::memcmp( name.data(), _name.data, _name.size ) ) {
+                    return nodeIdx;
                 }
             }
         }
+        return -1;
+    }
+
+    inline void insertChildSlot( int _nodeIdx )
+    {
+        std::size_t mask( childTable_.size() - 1 );
+        std::size_t slot( nodeHashes_[ _nodeIdx ] & mask );
+        while ( childTable_[ slot ] >= 0 ) {
+            slot = ( slot + 1 ) & mask;
+        }
+        childTable_[ slot ] = _nodeIdx;
+    }
+
+    /// register the node just pushed as the last child of its parent, the
+    /// tail keeps the append O(1) and the siblings in input order
+    inline void appendChild( int _nodeIdx, quint32 _hash )
+    {
+        nodeHashes_.push_back( _hash );
+        nodeFirstChildren_.push_back( -1 );
+        nodeLastChildren_.push_back( -1 );
+        nodeNextSiblings_.push_back( -1 );
+
+        int parentIdx( nodeParents_[ _nodeIdx ] );
+        int& first( parentIdx < 0 ? firstRootNode_ : nodeFirstChildren_[ parentIdx ] );
+        int& last( parentIdx < 0 ? lastRootNode_ : nodeLastChildren_[ parentIdx ] );
+        if ( last < 0 ) {
+            first = _nodeIdx;
+        } else {
+            nodeNextSiblings_[ last ] = _nodeIdx;
+        }
+        last = _nodeIdx;
+
+        /// keep the load factor at most 1 / 2, all the nodes are in the table
+        if ( nodeHashes_.size() * 2 > childTable_.size() ) {
+            childTable_.assign( std::max< std::size_t >( 64, childTable_.size() * 2 ), -1 );
+            for ( int idx( 0 ); idx < _nodeIdx; ++idx ) {
+                insertChildSlot( idx );
+            }
+        }
+        insertChildSlot( _nodeIdx );
+    }
+
+    /// find the child named '_name' under '_parentIdx' or create it; only a
+    /// created item converts its name to QString
+    template< typename ParentItemT >
+    inline int createWidgetItem( ParentItemT _parent, int _parentIdx, const HierarchyViewToken& _name, const std::string& _states, int _defaultState )
+    {
+
+        /// check if item already been created, only the direct children of
+        /// the parent are looked at
+        quint32 hash( childHash( _parentIdx, _name ) );
+        int childIdx( findChild( _parentIdx, _name, hash ) );
+        if ( childIdx >= 0 ) {
+            return childIdx;
+        }
 
         /// create new one if not exists
-        if ( !item ) {
-            int itemIndex( static_cast< int >( items_.size() ) );
+        int itemIndex( static_cast< int >( items_.size() ) );
+
+        /// the item has no text of its own, the name is decoded from 'items_'
+        /// when it is shown, see HierarchyViewItem::data()
+        QTreeWidgetItem* item = new HierarchyViewItem( itemIndex );
+        item->setFlags( item->flags() | Qt::ItemIsUserCheckable );
+
+        /// the state is set before the item joins the tree, so it goes to the
+        /// item only, no itemChanged() and no valueChanged() round trip
+        bool state( static_cast< std::size_t >( itemIndex ) < _states.size() ? int( char( _states[ static_cast< std::size_t >( itemIndex ) ] - '0' ) ) : _defaultState );
+        if ( state ) {
+            item->setCheckState( 0, Qt::Checked );
+        } else {
+            item->setCheckState( 0, Qt::Unchecked );
+        }
 
-            /// if not found, the root item has not been created yet
-            item = new QTreeWidgetItem( ( ParentItemT )0, QStringList( _name ) );
-            item->setFlags( item->flags() | Qt::ItemIsUserCheckable );
+        addItemToParent( _parent, item );
 
-            widget_->setAbsIndex( item, itemIndex );
+        items_.push_back( std::string( _name.data, _name.size ) );
+        allStates_.push_back( state );
+        allStatesStrDirty_ = true;
+        nodeParents_.push_back( _parentIdx );
+        nodeItems_.push_back( item );
+        appendChild( itemIndex, hash );
 
-            addItemToParent( _parent, item );
+        return itemIndex;
+    }
 
-            indexMap_[ _fullPath + "/" + _name.toStdString() ] = itemIndex;
+    template< typename SeparatorT >
+    inline void buildItems( const char* const* _items, int _itemLen, const SeparatorT& _sep, const std::string& _states, int _defaultState )
+    {
+        HierarchyViewToken token;
 
-            bool state( itemIndex < _stateLen ? int( char( _states[ static_cast< std::size_t >( itemIndex ) ] - '0' ) ) : _defaultState );
-            if ( state ) {
-                item->setCheckState( 0, Qt::Checked );
-            } else {
-                item->setCheckState( 0, Qt::Unchecked );
-            }
+        for ( int idx( 0 ); idx < _itemLen; ++idx ) {
+            int parentIdx( -1 );
 
-            items_.push_back( std::make_pair( _name.toStdString(), _fullPath + "/" + _name.toStdString() ) );
-            allStatesStr_.push_back( state ? '1' : '0' );
-        }
+            /// this variable denotes the item state, also considers the
+            /// parent nodes
+            bool itemState( true );
 
-        return item;
+            HierarchyViewTokenizer< SeparatorT > tokenizer( _items[ idx ] ? _items[ idx ] : "", _sep );
+            while ( tokenizer.next( token ) ) {
+                if ( parentIdx < 0 ) {
+                    parentIdx = createWidgetItem( widget_, parentIdx, token, _states, _defaultState );
+                } else {
+                    parentIdx = createWidgetItem( nodeItems_[ parentIdx ], parentIdx, token, _states, _defaultState );
+                }
+
+                if ( itemState && ! allStates_.get( static_cast< std::size_t >( parentIdx ) ) ) {
+                    itemState = false;
+                }
+            }
+            itemStates_.push_back( itemState );
+            itemNodes_.push_back( parentIdx );
+        }
     }
 
     inline void reset( const char* const* _items, int _itemLen, char _sep, const char* _states, int _defaultState )
@@ -446,60 +2185,210 @@ public:
 
             widget_->setSuspendUpdate( true );
 
-            widget_->itemIndices().reserve( _itemLen );
+            /// sort once when all items are added, rather than on every insertion
+            bool sorting( widget_->isSortingEnabled() );
+            widget_->setSortingEnabled( false );
 
-            int stateLen( static_cast< int >( states.size() ) );
-            QTreeWidgetItem* parent = NULL;
-            std::string fullPath;
+            itemNodes_.reserve( _itemLen );
 
-            for ( int idx( 0 ); idx < _itemLen; ++idx ) {
-                parent = NULL;
-                fullPath.clear();
+            /// the usual separators are specialized at compile time
+            switch ( _sep ) {
+                case '/':
+                    buildItems( _items, _itemLen, HierarchyViewSeparator< '/' >(), states, _defaultState );
+                    break;
+                case '|':
+                    buildItems( _items, _itemLen, HierarchyViewSeparator< '|' >(), states, _defaultState );
+                    break;
+                case '\0':
+                    buildItems( _items, _itemLen, HierarchyViewSeparator< '\0' >(), states, _defaultState );
+                    break;
+                default:
+                    buildItems( _items, _itemLen, HierarchyViewAnySeparator( _sep ), states, _defaultState );
+                    break;
+            }
+            buildSubtreeRanges();
+            markAllItemsChanged();
+
+            /// the items were created as checked / unchecked, mark the mixed
+            /// ones as partially checked
+            buildUncheckedDescendants();
+            widget_->beginBulkUpdate();
+            for ( std::size_t idx( 0 ); idx < nodeItems_.size(); ++idx ) {
+                if ( uncheckedDescendants_[ idx ] > 0 ) {
+                    updateCheckState( static_cast< int >( idx ) );
+                }
+            }
+            widget_->endBulkUpdate();
 
-                /// this variable denotes the item state, also considers the
-                /// parent nodes
-                bool itemState( true );
+            widget_->setSortingEnabled( sorting );
+            widget_->expandAll();
 
-                QStringList tokens;
-                if ( _sep != '\0' ) {
-                    tokens = QStringList( QString::fromStdString( _items[ idx ] ).split( _sep, QString::SkipEmptyParts) );
-                } else {
-                    tokens = QStringList( QString::fromStdString( _items[ idx ] ) );
-                }
+            widget_->setSuspendUpdate( false );
+        }
+    }
 
-                for ( int tokenIdx( 0 ); tokenIdx < tokens.size(); ++tokenIdx ) {
-                    QString itemStr( tokens.at( tokenIdx ) );
+private:
+    /// order the original items by the pre-order of their nodes, so that the
+    /// items under any node are a contiguous range of 'subtreeItemStates_'
+    inline void buildSubtreeRanges()
+    {
+        std::size_t nodeSize( nodeParents_.size() );
+
+        /// pre-order numbering over the sibling lists, which are in creation
+        /// order, a.k.a the order they are shown; the stack holds at most one
+        /// pending sibling per level
+        std::vector< int > preorder( nodeSize );
+        std::vector< int > order( nodeSize );
+        std::vector< int > stack;
+        if ( firstRootNode_ >= 0 ) {
+            stack.push_back( firstRootNode_ );
+        }
+        int counter( 0 );
+        while ( !stack.empty() ) {
+            int node( stack.back() );
+            stack.pop_back();
+            preorder[ node ] = counter;
+            order[ counter ] = node;
+            ++counter;
+            if ( nodeNextSiblings_[ node ] >= 0 ) {
+                stack.push_back( nodeNextSiblings_[ node ] );
+            }
+            if ( nodeFirstChildren_[ node ] >= 0 ) {
+                stack.push_back( nodeFirstChildren_[ node ] );
+            }
+        }
 
-                    if ( !parent ) {
-                        parent = createWidgetItem( widget_, widget_, itemStr, fullPath, stateLen, states, _defaultState );
-                    } else {
-                        parent = createWidgetItem( parent, parent->child( 0 ), itemStr, fullPath, stateLen, states, _defaultState );
-                    }
+        /// subtree sizes, children always come after their parent in pre-order
+        std::vector< int > subtreeSizes( nodeSize, 1 );
+        for ( int preIdx( static_cast< int >( nodeSize ) - 1 ); preIdx >= 0; --preIdx ) {
+            int node( order[ preIdx ] );
+            if ( nodeParents_[ node ] >= 0 ) {
+                subtreeSizes[ nodeParents_[ node ] ] += subtreeSizes[ node ];
+            }
+        }
 
-                    if ( parent && itemState && ! parent->checkState( 0 ) ) {
-                        itemState = false;
-                    }
+        /// counting sort of the items by the pre-order of their nodes
+        std::vector< int > itemStarts( nodeSize + 1, 0 );
+        for ( std::size_t idx( 0 ); idx < itemNodes_.size(); ++idx ) {
+            if ( itemNodes_[ idx ] >= 0 ) {
+                ++itemStarts[ preorder[ itemNodes_[ idx ] ] + 1 ];
+            }
+        }
+        for ( std::size_t idx( 1 ); idx < itemStarts.size(); ++idx ) {
+            itemStarts[ idx ] += itemStarts[ idx - 1 ];
+        }
+        std::vector< int > itemCursors( itemStarts.begin(), itemStarts.end() - 1 );
+        itemPositions_.assign( itemNodes_.size(), -1 );
+        positionItems_.assign( itemStarts.back(), -1 );
+        for ( std::size_t idx( 0 ); idx < itemNodes_.size(); ++idx ) {
+            if ( itemNodes_[ idx ] >= 0 ) {
+                itemPositions_[ idx ] = itemCursors[ preorder[ itemNodes_[ idx ] ] ]++;
+                positionItems_[ itemPositions_[ idx ] ] = static_cast< int >( idx );
+            }
+        }
 
-                    fullPath = fullPath + "/" + itemStr.toStdString();
+        nodeItemIndices_.assign( nodeSize, -1 );
+        for ( std::size_t idx( 0 ); idx < itemNodes_.size(); ++idx ) {
+            if ( itemNodes_[ idx ] >= 0 && nodeItemIndices_[ itemNodes_[ idx ] ] < 0 ) {
+                nodeItemIndices_[ itemNodes_[ idx ] ] = static_cast< int >( idx );
+                if ( static_cast< std::size_t >( itemNodes_[ idx ] ) < nodeItems_.size() ) {
+                    static_cast< HierarchyViewItem* >( nodeItems_[ itemNodes_[ idx ] ] )->setItemIndex( static_cast< int >( idx ) );
                 }
-                widget_->itemIndices().append( QPair< QString, QTreeWidgetItem* >( fullPath.c_str(), parent ) );
-                itemStatesStr_.push_back( itemState ? '1' : '0' );
             }
-            widget_->expandAll();
+        }
 
-            widget_->setSuspendUpdate( false );
+        nodeItemRanges_.resize( nodeSize );
+        for ( std::size_t idx( 0 ); idx < nodeSize; ++idx ) {
+            nodeItemRanges_[ idx ] = std::make_pair( itemStarts[ preorder[ idx ] ], itemStarts[ preorder[ idx ] + subtreeSizes[ idx ] ] );
+        }
+
+        buildSubtreeItemStates();
+    }
+
+    /// 'itemStates_' in the order of 'itemPositions_', rebuilt on the write
+    /// paths when the item states are replaced as a whole, e.g. by
+    /// from_script(), and kept in sync by setItemState(), so that the const
+    /// queries only read
+    inline void buildSubtreeItemStates()
+    {
+        subtreeItemStates_.assign( nodeItemRanges_.empty() ? 0 : itemPositions_.size(), false );
+        for ( std::size_t idx( 0 ); idx < itemPositions_.size(); ++idx ) {
+            if ( itemPositions_[ idx ] >= 0 && idx < itemStates_.size() ) {
+                subtreeItemStates_.set( static_cast< std::size_t >( itemPositions_[ idx ] ), itemStates_.get( idx ) );
+            }
         }
     }
 
 private:
     HierarchyViewWidget* widget_;
-    std::vector< std::pair<
-            std::string,    /// name
-            std::string     /// full path
-        > > items_;
-    std::string allStatesStr_;
-    std::string itemStatesStr_;
-    std::map< std::string, int > indexMap_;
+    /// name of every flattened node
+    std::vector< std::string > items_;
+    /// packed states of the flattened hierarchy and of the original items
+    HierarchyViewStates allStates_;
+    HierarchyViewStates itemStates_;
+    /// cached text form of 'allStates_', see allStatesStr()
+    mutable std::string allStatesStr_;
+    mutable bool allStatesStrDirty_;
+    /// hierarchy topology, the parent node of every flattened node and the
+    /// node of every original item, -1 for none
+    std::vector< int > nodeParents_;
+    std::vector< int > itemNodes_;
+    /// widget item of every flattened node
+    std::vector< QTreeWidgetItem* > nodeItems_;
+    /// children of every node as a list in input order with a tail for O(1)
+    /// append, -1 for none; the top level nodes are listed from 'firstRootNode_'
+    std::vector< int > nodeFirstChildren_;
+    std::vector< int > nodeLastChildren_;
+    std::vector< int > nodeNextSiblings_;
+    int firstRootNode_;
+    int lastRootNode_;
+    /// hash of every node by parent and name, and the open addressing table
+    /// of the nodes, see findChild()
+    std::vector< quint32 > nodeHashes_;
+    std::vector< int > childTable_;
+    /// the first original item of every flattened node, -1 for none
+    std::vector< int > nodeItemIndices_;
+    /// number of disabled nodes below every node, updated along the ancestor
+    /// chain on every change, drives the partially checked state
+    std::vector< int > uncheckedDescendants_;
+    /// range of 'subtreeItemStates_' covered by the subtree of every node and
+    /// the position of every original item in it and its inverse, see
+    /// buildSubtreeRanges()
+    std::vector< std::pair< int, int > > nodeItemRanges_;
+    std::vector< int > itemPositions_;
+    std::vector< int > positionItems_;
+    HierarchyViewStates subtreeItemStates_;
+    /// extra columns, kept here so that they survive the widget
+    QStringList columnLabels_;
+    HierarchyViewKnob::ColumnCallback columnCB_;
+    void* columnClosure_;
+    /// state observers, the original items changed since the last
+    /// notification, the '[ begin, end )' span of them and the nesting level
+    /// of beginEdit()
+    std::vector< std::pair< HierarchyViewKnob::ObserverCallback, void* > > observers_;
+    HierarchyViewStates changedItems_;
+    std::size_t changedBegin_;
+    std::size_t changedEnd_;
+    int editDepth_;
+    /// named selection presets, in the order they were saved
+    std::vector< Preset > presets_;
+    /// per-frame states ordered by frame, the sizes of the hierarchy they
+    /// were set for, their checkpoints, see buildKeyCheckpoints(), the states
+    /// at 'resolvedKey_' ( -1 for none ) and the text form of every key,
+    /// filled on demand
+    std::vector< Keyframe > keys_;
+    std::size_t keyAllSize_;
+    std::size_t keyItemSize_;
+    std::vector< KeyCheckpoint > keyCheckpoints_;
+    mutable HierarchyViewStates resolvedAllStates_;
+    mutable HierarchyViewStates resolvedItemStates_;
+    mutable int resolvedKey_;
+    mutable std::vector< std::string > keyTexts_;
+    /// binary sidecar, disabled if the path is empty, and the states of the
+    /// latest references written or loaded, most recent last
+    std::string sidecarBaseDir_;
+    std::string sidecarPath_;
+    mutable std::vector< SidecarSnapshot > sidecarSnapshots_;
 };
 
 
@@ -539,9 +2428,10 @@ bool HierarchyViewKnob::from_script( const char* _v )
 {
     if ( _v ) {
         new_undo( "setValue" );
-        impl_->from_script( _v );
+        bool ok( impl_->from_script( _v ) );
         changed();
-        return true;
+        impl_->notifyObservers();
+        return ok;
     }
     return false;
 }
@@ -592,9 +2482,9 @@ void HierarchyViewKnob::setHeader( const char* _text )
 void HierarchyViewKnob::setState( int _idx, int _v )
 {
     if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->statesSize() ) {
-        new_undo( "setValue" );
+        beginEdit();
         impl_->setState( _idx, _v );
-        changed();
+        endEdit();
     }
 }
 
@@ -610,9 +2500,18 @@ int  HierarchyViewKnob::getState( int _idx ) const
 void HierarchyViewKnob::setItemState( int _idx, int _v )
 {
     if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->itemStatesSize() ) {
-        new_undo( "setValue" );
+        beginEdit();
         impl_->setItemState( _idx, _v );
-        changed();
+        endEdit();
+    }
+}
+
+void HierarchyViewKnob::updateItemStates( int _idx )
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->nodeSize() && impl_->statesMatchHierarchy() ) {
+        beginEdit();
+        impl_->updateItemStates( _idx );
+        endEdit();
     }
 }
 
@@ -624,6 +2523,66 @@ int  HierarchyViewKnob::getItemState( int _idx ) const
     return -1;
 }
 
+int HierarchyViewKnob::countEnabled() const
+{
+    return static_cast< int >( impl_->countEnabled() );
+}
+
+int HierarchyViewKnob::countEnabledInSubtree( int _idx ) const
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->nodeSize() ) {
+        return static_cast< int >( impl_->countEnabledInSubtree( _idx ) );
+    }
+    return -1;
+}
+
+int HierarchyViewKnob::anyEnabledInSubtree( int _idx ) const
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->nodeSize() ) {
+        return impl_->countEnabledInSubtree( _idx ) > 0;
+    }
+    return -1;
+}
+
+int HierarchyViewKnob::getEnabledItemRanges( int* _ranges, int _maxRanges ) const
+{
+    return impl_->enabledItemRanges( _ranges, _maxRanges );
+}
+
+int HierarchyViewKnob::getItemState( int _idx, double _frame ) const
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->itemStatesSize() ) {
+        return impl_->itemStateAt( _idx, _frame );
+    }
+    return -1;
+}
+
+int HierarchyViewKnob::countEnabled( double _frame ) const
+{
+    return static_cast< int >( impl_->countEnabledAt( _frame ) );
+}
+
+int HierarchyViewKnob::getEnabledItemRanges( int* _ranges, int _maxRanges, double _frame ) const
+{
+    return impl_->enabledItemRangesAt( _ranges, _maxRanges, _frame );
+}
+
+int HierarchyViewKnob::getItemIndex( int _idx ) const
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->nodeSize() ) {
+        return impl_->itemIndex( _idx );
+    }
+    return -1;
+}
+
+const char* HierarchyViewKnob::getName( int _idx ) const
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->itemSize() ) {
+        return impl_->name( _idx );
+    }
+    return NULL;
+}
+
 void HierarchyViewKnob::clear()
 {
     return impl_->clear();
@@ -634,6 +2593,155 @@ void HierarchyViewKnob::reset( const char* const* _items, int _itemLen, char _se
     new_undo( "setValue" );
     impl_->reset( _items, _itemLen, _sep, _states, _defaultState );
     changed();
+    impl_->notifyObservers();
+}
+
+void HierarchyViewKnob::setColumns( const char* const* _labels, int _columnLen, ColumnCallback _cb, void* _closure )
+{
+    impl_->setColumns( _labels, _columnLen, _cb, _closure );
+}
+
+void HierarchyViewKnob::invalidateColumns()
+{
+    impl_->invalidateColumns();
+}
+
+void HierarchyViewKnob::addObserver( ObserverCallback _cb, void* _closure )
+{
+    if ( _cb ) {
+        impl_->addObserver( _cb, _closure );
+    }
+}
+
+void HierarchyViewKnob::removeObserver( ObserverCallback _cb, void* _closure )
+{
+    impl_->removeObserver( _cb, _closure );
+}
+
+void HierarchyViewKnob::beginEdit()
+{
+    /// the outermost edit opens the undo step of the whole batch
+    if ( impl_->beginEdit() ) {
+        new_undo( "setValue" );
+    }
+}
+
+void HierarchyViewKnob::endEdit()
+{
+    if ( impl_->endEdit() ) {
+        changed();
+        impl_->notifyObservers();
+    }
+}
+
+int HierarchyViewKnob::savePreset( const char* _name )
+{
+    if ( HierarchyViewKnobImp::isValidPresetName( _name ) ) {
+        new_undo( "savePreset" );
+        impl_->savePreset( _name );
+        changed();
+        return 1;
+    }
+    return 0;
+}
+
+int HierarchyViewKnob::applyPreset( const char* _name )
+{
+    int presetIdx( impl_->findPreset( _name ) );
+    if ( presetIdx < 0 || !impl_->presetMatchesHierarchy( presetIdx ) ) {
+        return -1;
+    }
+    /// a single undo step and a single notification for the whole preset
+    new_undo( "applyPreset" );
+    impl_->beginEdit();
+    int count( impl_->applyPreset( presetIdx ) );
+    impl_->endEdit();
+    changed();
+    impl_->notifyObservers();
+    return count;
+}
+
+void HierarchyViewKnob::removePreset( const char* _name )
+{
+    int presetIdx( impl_->findPreset( _name ) );
+    if ( presetIdx >= 0 ) {
+        new_undo( "removePreset" );
+        impl_->removePreset( presetIdx );
+        changed();
+    }
+}
+
+int HierarchyViewKnob::getPresetSize() const
+{
+    return static_cast< int >( impl_->presetSize() );
+}
+
+const char* HierarchyViewKnob::getPresetName( int _idx ) const
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->presetSize() ) {
+        return impl_->presetName( _idx ).c_str();
+    }
+    return NULL;
+}
+
+void HierarchyViewKnob::setKey( double _frame )
+{
+    new_undo( "setKey" );
+    impl_->setKey( _frame );
+    changed();
+}
+
+void HierarchyViewKnob::removeKey( double _frame )
+{
+    int keyIdx( impl_->findKey( _frame ) );
+    if ( keyIdx >= 0 ) {
+        new_undo( "removeKey" );
+        impl_->removeKey( keyIdx );
+        changed();
+    }
+}
+
+int HierarchyViewKnob::getKeySize() const
+{
+    return static_cast< int >( impl_->keySize() );
+}
+
+int HierarchyViewKnob::getKeyFrame( int _idx, double& _frame ) const
+{
+    if ( _idx >= 0 && static_cast< std::size_t >( _idx ) < impl_->keySize() ) {
+        _frame = impl_->keyFrame( _idx );
+        return 1;
+    }
+    return 0;
+}
+
+int HierarchyViewKnob::applyFrame( double _frame )
+{
+    if ( !impl_->hasKeys() ) {
+        return -1;
+    }
+    new_undo( "applyFrame" );
+    impl_->beginEdit();
+    int count( impl_->applyFrame( _frame ) );
+    impl_->endEdit();
+    changed();
+    impl_->notifyObservers();
+    return count;
+}
+
+void HierarchyViewKnob::setSidecar( const char* _baseDir, const char* _path )
+{
+    impl_->setSidecar( _baseDir, _path );
+}
+
+void HierarchyViewKnob::getMemoryUsage( MemoryUsage& _usage ) const
+{
+    impl_->memoryUsage( _usage );
+}
+
+void HierarchyViewKnob::getTotalMemoryUsage( MemoryUsage& _usage )
+{
+    HierarchyViewKnobImp::totalMemoryUsage( _usage );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -36,6 +36,8 @@
 #include <DDImage/ddImageVersionNumbers.h>
 #include <DDImage/Knob.h>
 
+#include <stddef.h>
+
 class HierarchyViewKnobImp;
 
 class ATOM_DLL_SPEC HierarchyViewKnob : public DD::Image::Knob
@@ -47,6 +49,10 @@ public:
     virtual bool not_default () const;
     virtual void to_script (std::ostream& _os, const DD::Image::OutputContext* _oc, bool _quote) const;
     virtual bool from_script(const char * v);
+    /// to_script() streams the states in chunks, but store() and get_text()
+    /// have to return a C string: a '0' / '1' copy of the flattened states is
+    /// kept per knob, and per key that was asked for, one byte per flattened
+    /// item on top of the packed states
     virtual void store( DD::Image::StoreType _type, void* _data, DD::Image::Hash& _hash, const DD::Image::OutputContext& _oc);
     virtual const char* get_text( const DD::Image::OutputContext* _oc = 0 ) const;
 
@@ -65,14 +71,39 @@ public:
 
     /// set header text
     void setHeader( const char* _text );
-    /// get and set state of the index of flattened hierarchy, this index is the
-    /// same as the visually index in the knob
+    /// get and set state of the index of flattened hierarchy, the order the
+    /// nodes were created in; it is the visual order of the knob until the
+    /// items are sorted by an extra column, see setColumns()
     void setState( int _idx, int _v );
     int  getState( int _idx ) const;
     /// get and set state of the index of original items ( before expaneding to
     /// be a hierarchy )
     void setItemState( int _idx, int _v );
     int  getItemState( int _idx ) const;
+    /// update the states of the original items in the subtree of the index
+    /// of flattened hierarchy '_idx' after its state changed, as the widget
+    /// does when an item is toggled
+    void updateItemStates( int _idx );
+    /// aggregate queries over the states of original items, answered from the
+    /// packed states instead of looping getItemState();
+    /// '_idx' of the subtree queries is the index of flattened hierarchy, an
+    /// item is counted if its path ends at this node or below it, -1 is
+    /// returned if '_idx' is out of range; these queries never write, so
+    /// render threads may call them concurrently while no state changes
+    int  countEnabled() const;
+    int  countEnabledInSubtree( int _idx ) const;
+    int  anyEnabledInSubtree( int _idx ) const;
+    /// enabled original items as sorted '[ begin, end )' ranges, written as
+    /// pairs of int into '_ranges', which holds '_maxRanges' pairs; returns the
+    /// total number of ranges, which could be more than '_maxRanges', so
+    /// calling with ( NULL, 0 ) queries the size of buffer
+    int  getEnabledItemRanges( int* _ranges, int _maxRanges ) const;
+    /// get the index of original item whose path ends at the index of
+    /// flattened hierarchy '_idx', -1 if it is an intermediate node
+    int  getItemIndex( int _idx ) const;
+    /// get the name of the index of flattened hierarchy '_idx', the part of
+    /// the path at its level, NULL if '_idx' is out of range
+    const char* getName( int _idx ) const;
     /// clear the widget, NOTE: the state string in knob does not clear
     /// automatically, clear the string by calling knob("...")->set_text() if
     /// you want to keep data synchronized
@@ -90,6 +121,121 @@ public:
     /// result items is possible, then '_defaultState' is used when create the
     /// item
     void reset( const char* const* _items, int _itemLen, char _sep, const char* _states, int _defaultState );
+public:
+    /// extra columns, e.g. type, vertex count or bounds size of the items
+
+    /// column provider, writes the text of column '_column' ( starts from 1,
+    /// column 0 is the item name ) of the flattened index '_idx' into '_buf',
+    /// which holds '_bufLen' bytes including the terminating '\0'; '_itemIdx'
+    /// is the same as getItemIndex( _idx ).
+    /// Returns the full length of the text like snprintf(), the provider is
+    /// called again with a buffer large enough if the text was truncated, or
+    /// -1 if there is no value.
+    /// The provider is only called for the rows being shown and when sorting
+    /// by a column, the results are cached.
+    typedef int ( *ColumnCallback )( void* _closure, int _idx, int _itemIdx, int _column, char* _buf, int _bufLen );
+    /// set the labels of the extra columns and their provider, clicking a
+    /// header sorts by the column, numeric texts are compared by value;
+    /// '_columnLen' == 0 removes the extra columns
+    void setColumns( const char* const* _labels, int _columnLen, ColumnCallback _cb, void* _closure );
+    /// drop the cached column texts, call this when the provider would return
+    /// different values
+    void invalidateColumns();
+public:
+    /// observers of the states of original items
+
+    /// observer callback, receives the changed original items as sorted and
+    /// coalesced '[ begin, end )' ranges, '_ranges' holds '_rangeLen' pairs of
+    /// int and is only valid during the call; reset() and from_script()
+    /// report all the items
+    typedef void ( *ObserverCallback )( void* _closure, const int* _ranges, int _rangeLen );
+    void addObserver( ObserverCallback _cb, void* _closure );
+    void removeObserver( ObserverCallback _cb, void* _closure );
+    /// group several edits, e.g. setState() / setItemState() in a loop; the
+    /// outermost beginEdit() / endEdit() pair makes a single undo step, a
+    /// single changed() and a single redraw of the widget, and observers are
+    /// called once at the outermost endEdit() instead of after each edit
+    void beginEdit();
+    void endEdit();
+public:
+    /// named selection presets, saved into the script together with the states
+
+    /// save the current states as preset '_name', replacing the preset of the
+    /// same name; the name must not be empty nor contain white spaces or any
+    /// of '{}[]:,;"\$', returns 0 if the name is not valid
+    int  savePreset( const char* _name );
+    /// apply a preset, only the differing states are changed and one undo step
+    /// is recorded; returns the number of flattened items changed, -1 if there
+    /// is no such preset or it was saved for a hierarchy of different size
+    int  applyPreset( const char* _name );
+    void removePreset( const char* _name );
+    int  getPresetSize() const;
+    const char* getPresetName( int _idx ) const;
+public:
+    /// per-frame states, the states of a frame are those of the last key at
+    /// or before it, or of the first key for the frames before; without keys
+    /// the states are the same on every frame. With keys, store(), and
+    /// get_text() and to_script() given an OutputContext, use the states of
+    /// its frame; the widget edits the current states, which are recorded by
+    /// setKey(). A key stores the items changed since the previous key as
+    /// runs, in memory and in the script, and every 32nd key the full states.
+
+    /// record the current states as the key at '_frame', replacing the key of
+    /// the same frame; the keys set for a hierarchy of different size are
+    /// dropped
+    void setKey( double _frame );
+    void removeKey( double _frame );
+    int  getKeySize() const;
+    /// returns 0 if '_idx' is out of range
+    int  getKeyFrame( int _idx, double& _frame ) const;
+    /// the queries of the original items above at '_frame', e.g. the frame
+    /// of the OutputContext when rendering; the states of the key in effect,
+    /// its checkpoint and the runs of at most 31 keys, or the current states
+    /// without keys
+    int  getItemState( int _idx, double _frame ) const;
+    int  countEnabled( double _frame ) const;
+    int  getEnabledItemRanges( int* _ranges, int _maxRanges, double _frame ) const;
+    /// set the current states to those of '_frame', e.g. when the frame of
+    /// the viewer changes; returns the number of flattened items changed, -1
+    /// if there is no key for this hierarchy
+    int  applyFrame( double _frame );
+public:
+    /// opt-in binary sidecar for very large hierarchies, when '_path' is set
+    /// to_script() writes the states into the file '_path' and only a
+    /// reference ( content hash and '_path' ) into the script. There is one
+    /// file per knob, it is replaced only when the states changed since it
+    /// was written, so undo, autosave and copy don't add files. The states of
+    /// the latest references are kept in memory as well, so that undo still
+    /// restores states the file no longer holds.
+    /// A relative '_path' is relative to '_baseDir', e.g. the directory of the
+    /// Nuke script; without '_baseDir' only an absolute '_path' is used. Set it
+    /// before the script is loaded, e.g. in knobs(), since from_script()
+    /// resolves the reference the same way. If the sidecar can't be written
+    /// the states are written inline, if neither the file nor the memory has
+    /// the states of the hash when loading, from_script() returns false and
+    /// the current states are kept.
+    /// Passing an empty '_path' disables the sidecar.
+    void setSidecar( const char* _baseDir, const char* _path );
+public:
+    /// estimated memory footprint in bytes: the containers are counted from
+    /// their sizes and capacities, but the Qt items and the nodes of hashes
+    /// and maps are counted with fixed per-object overheads that are guesses,
+    /// not measurements, so compare the figures rather than trust the bytes.
+    /// NOTE: main thread only, like the widget, the containers and the Qt
+    /// items are read without any lock
+    struct MemoryUsage {
+        size_t hierarchy;   /// topology, index tables and the path map
+        size_t strings;     /// item names and paths
+        size_t states;      /// state bitsets, presets, keys and the text form
+        size_t widgetItems; /// tree widget items and the index tables of widget
+        size_t caches;      /// column texts, rank directories, change tracking
+        size_t total;
+    };
+    void getMemoryUsage( MemoryUsage& _usage ) const;
+    /// sum of getMemoryUsage() of all the knobs alive in the process, main
+    /// thread only as well: the lock only guards the list of knobs, not what
+    /// every knob holds
+    static void getTotalMemoryUsage( MemoryUsage& _usage );
 public:
     /// helper function to create an item list, the implementation behind is a
     /// std::vector< const char* >, but to simplify the interface and runtime
@@ -0,0 +1,549 @@
+// -----------------------------------------------------------------------------
+// 2009-2013 by Jupiter Jazz Limited.
+//
+// This software, excluded third party dependencies, is released in public domain,
+// see unlicense.txt file for more detail.
+//
+// IMPORTATNT:
+// NUKE is a trademark of The Foundry Visionmongers Ltd.
+// Qt is a trademark of Digia Plc and/or its subsidiary(-ies).
+// -----------------------------------------------------------------------------
+
+#ifndef HIERARCHY_VIEW_STATES_H
+#define HIERARCHY_VIEW_STATES_H
+
+#include <QtCore/QtGlobal>
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/// SIMD paths are picked at compile time, the scalar path is always available
+/// and used for the unaligned head and the tail of every buffer
+#if defined( __AVX2__ )
+    #define HIERARCHY_VIEW_AVX2
+    #include <immintrin.h>
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+    #define HIERARCHY_VIEW_SSE2
+    #include <emmintrin.h>
+#endif
+
+#if defined( _MSC_VER )
+    #include <intrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// HierarchyViewStates
+/// Packed storage of the item states, one bit per item. Bits beyond size() in
+/// the last word are always kept zero, so that the words can be hashed and
+/// counted directly.
+/// The text form ( one '0' / '1' character per item ) is only produced when
+/// serializing, see parse() and toText().
+/// The rank directory is kept up to date by every write, so the const
+/// queries never write and may run concurrently as long as no write does.
+////////////////////////////////////////////////////////////////////////////////
+
+class HierarchyViewStates
+{
+public:
+    typedef quint64 WordT;
+    enum { kWordBits = 64 };
+
+    /// number of words summed up by one entry of the rank directory
+    enum { kRankBlockWords = 8 };
+
+    HierarchyViewStates() : words_(), size_( 0 ), ranks_( 1, 0 ) {}
+
+    inline std::size_t size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+    inline const WordT* words() const { return words_.empty() ? NULL : &words_[ 0 ]; }
+    inline std::size_t wordSize() const { return words_.size(); }
+
+    inline void clear()
+    {
+        words_.clear();
+        size_ = 0;
+        ranks_.assign( 1, 0 );
+    }
+
+    inline void assign( std::size_t _len, bool _v )
+    {
+        words_.assign( ( _len + kWordBits - 1 ) / kWordBits, _v ? ~WordT( 0 ) : WordT( 0 ) );
+        size_ = _len;
+        if ( _v && _len % kWordBits ) {
+            words_.back() &= ( WordT( 1 ) << ( _len % kWordBits ) ) - 1;
+        }
+        buildRanks();
+    }
+
+    /// replace the states by '_len' states packed in '_words', e.g. from a
+    /// memory mapped file, '_words' holds ( _len + 63 ) / 64 words
+    inline void assignWords( const void* _words, std::size_t _len )
+    {
+        words_.resize( ( _len + kWordBits - 1 ) / kWordBits );
+        if ( !words_.empty() ) {
+            ::memcpy( &words_[ 0 ], _words, words_.size() * sizeof( WordT ) );
+            if ( _len % kWordBits ) {
+                words_.back() &= ( WordT( 1 ) << ( _len % kWordBits ) ) - 1;
+            }
+        }
+        size_ = _len;
+        buildRanks();
+    }
+
+    inline void reserve( std::size_t _len )
+    {
+        words_.reserve( ( _len + kWordBits - 1 ) / kWordBits );
+    }
+
+    inline bool get( std::size_t _idx ) const
+    {
+        /// caller should handle boundary checking
+        return ( words_[ _idx / kWordBits ] >> ( _idx % kWordBits ) ) & 1;
+    }
+
+    inline void set( std::size_t _idx, bool _v )
+    {
+        /// caller should handle boundary checking
+        if ( get( _idx ) == _v ) {
+            return;
+        }
+        words_[ _idx / kWordBits ] ^= WordT( 1 ) << ( _idx % kWordBits );
+        addRank( _idx / kWordBits / kRankBlockWords, _v ? 1 : -1 );
+    }
+
+    inline void push_back( bool _v )
+    {
+        if ( size_ % kWordBits == 0 ) {
+            pushWord();
+        }
+        if ( _v ) {
+            words_.back() |= WordT( 1 ) << ( size_ % kWordBits );
+            addRank( ( words_.size() - 1 ) / kRankBlockWords, 1 );
+        }
+        ++size_;
+    }
+
+    /// append the lowest '_count' bits of '_bits', the lowest bit first,
+    /// '_count' must not exceed 32
+    inline void appendBits( quint32 _bits, int _count )
+    {
+        if ( _count <= 0 ) {
+            return;
+        }
+        if ( _count < 32 ) {
+            _bits &= ( quint32( 1 ) << _count ) - 1;
+        }
+        std::size_t offset( size_ % kWordBits );
+        if ( offset == 0 ) {
+            pushWord();
+        }
+        words_.back() |= WordT( _bits ) << offset;
+        addRank( ( words_.size() - 1 ) / kRankBlockWords, popCount( WordT( _bits ) << offset ) );
+        if ( offset + _count > kWordBits ) {
+            pushWord();
+            words_.back() = WordT( _bits ) >> ( kWordBits - offset );
+            addRank( ( words_.size() - 1 ) / kRankBlockWords, popCount( words_.back() ) );
+        }
+        size_ += _count;
+    }
+
+    /// flip the bits which are set in '_other', a.k.a the bits where the two
+    /// states differ afterwards, caller should make sure the sizes are equal
+    inline void xorWith( const HierarchyViewStates& _other )
+    {
+        for ( std::size_t idx( 0 ); idx < words_.size() && idx < _other.words_.size(); ++idx ) {
+            words_[ idx ] ^= _other.words_[ idx ];
+        }
+        buildRanks();
+    }
+
+    /// flip the bits in '[ _begin, _end )', caller should handle boundary
+    /// checking; only the words of the range and their ranks are touched, so
+    /// a short run costs O( log N ) whatever the size
+    inline void flip( std::size_t _begin, std::size_t _end )
+    {
+        while ( _begin < _end ) {
+            std::size_t wordIdx( _begin / kWordBits );
+            std::size_t shift( _begin % kWordBits );
+            std::size_t bits( std::min( _end - _begin, static_cast< std::size_t >( kWordBits ) - shift ) );
+            WordT mask( bits == kWordBits ? ~WordT( 0 ) : ( ( WordT( 1 ) << bits ) - 1 ) << shift );
+            int before( popCount( words_[ wordIdx ] ) );
+            words_[ wordIdx ] ^= mask;
+            addRank( wordIdx / kRankBlockWords, popCount( words_[ wordIdx ] ) - before );
+            _begin += bits;
+        }
+    }
+
+    /// heap memory in bytes, the rank directory included
+    inline std::size_t memoryUsage() const
+    {
+        return words_.capacity() * sizeof( WordT ) + ranks_.capacity() * sizeof( std::size_t );
+    }
+
+    inline bool operator==( const HierarchyViewStates& _other ) const
+    {
+        return size_ == _other.size_ && words_ == _other.words_;
+    }
+
+    inline bool operator!=( const HierarchyViewStates& _other ) const
+    {
+        return !( *this == _other );
+    }
+
+    /// number of set bits
+    inline std::size_t count() const
+    {
+        return rank( size_ );
+    }
+
+    /// number of set bits in '[ _begin, _end )', caller should handle
+    /// boundary checking
+    inline std::size_t count( std::size_t _begin, std::size_t _end ) const
+    {
+        return _begin < _end ? rank( _end ) - rank( _begin ) : 0;
+    }
+
+    /// number of set bits in '[ 0, _idx )', O( log N ) reads of the rank
+    /// directory and at most kRankBlockWords words
+    inline std::size_t rank( std::size_t _idx ) const
+    {
+        std::size_t wordIdx( _idx / kWordBits );
+        std::size_t blockIdx( wordIdx / kRankBlockWords );
+        std::size_t result( 0 );
+        for ( std::size_t node( blockIdx ); node > 0; node &= node - 1 ) {
+            result += ranks_[ node ];
+        }
+        for ( std::size_t idx( blockIdx * kRankBlockWords ); idx < wordIdx; ++idx ) {
+            result += popCount( words_[ idx ] );
+        }
+        if ( _idx % kWordBits ) {
+            result += popCount( words_[ wordIdx ] & ( ( WordT( 1 ) << ( _idx % kWordBits ) ) - 1 ) );
+        }
+        return result;
+    }
+
+    /// index of the first bit at or after '_from' whose value is '_v', size()
+    /// if there is none; whole words are skipped at once
+    inline std::size_t findNext( std::size_t _from, bool _v ) const
+    {
+        if ( _from >= size_ ) {
+            return size_;
+        }
+        std::size_t wordIdx( _from / kWordBits );
+        WordT flip( _v ? WordT( 0 ) : ~WordT( 0 ) );
+        WordT word( ( words_[ wordIdx ] ^ flip ) & ( ~WordT( 0 ) << ( _from % kWordBits ) ) );
+        while ( !word ) {
+            if ( ++wordIdx >= words_.size() ) {
+                return size_;
+            }
+            word = words_[ wordIdx ] ^ flip;
+        }
+        std::size_t idx( wordIdx * kWordBits + countTrailingZeros( word ) );
+        return idx < size_ ? idx : size_;
+    }
+
+    /// call '_func( begin, end )' for every run of set bits, in order
+    template< typename FuncT >
+    inline void forEachRange( FuncT& _func ) const
+    {
+        std::size_t end( 0 );
+        for ( std::size_t begin( findNext( 0, true ) ); begin < size_; begin = findNext( end, true ) ) {
+            end = findNext( begin, false );
+            _func( begin, end );
+        }
+    }
+
+public:
+    /// bit helpers, wrappers of the compiler intrinsics
+
+    static inline int countTrailingZeros( quint32 _v )
+    {
+        /// caller should make sure '_v' is not zero
+#if defined( _MSC_VER )
+        unsigned long idx;
+        _BitScanForward( &idx, _v );
+        return static_cast< int >( idx );
+#else
+        return __builtin_ctz( _v );
+#endif
+    }
+
+    static inline int countTrailingZeros( WordT _v )
+    {
+        /// caller should make sure '_v' is not zero
+#if defined( _MSC_VER ) && defined( _M_X64 )
+        unsigned long idx;
+        _BitScanForward64( &idx, _v );
+        return static_cast< int >( idx );
+#elif defined( _MSC_VER )
+        quint32 low( static_cast< quint32 >( _v ) );
+        return low ? countTrailingZeros( low ) : 32 + countTrailingZeros( static_cast< quint32 >( _v >> 32 ) );
+#else
+        return __builtin_ctzll( _v );
+#endif
+    }
+
+    static inline int popCount( WordT _v )
+    {
+#if defined( _MSC_VER ) && defined( _M_X64 )
+        return static_cast< int >( __popcnt64( _v ) );
+#elif defined( _MSC_VER )
+        return static_cast< int >( __popcnt( static_cast< unsigned int >( _v ) ) + __popcnt( static_cast< unsigned int >( _v >> 32 ) ) );
+#else
+        return __builtin_popcountll( _v );
+#endif
+    }
+
+public:
+    /// parse the states in '[ _begin, _end )' and append them, only '0' and
+    /// '1' are taken, any other character is skipped; parsing stops right
+    /// after the first '_term', the returned pointer is where it stopped
+    inline const char* parse( const char* _begin, const char* _end, char _term )
+    {
+        const char* p( _begin );
+
+#if defined( HIERARCHY_VIEW_AVX2 )
+        const __m256i zero32( _mm256_set1_epi8( '0' ) );
+        const __m256i one32( _mm256_set1_epi8( '1' ) );
+        const __m256i term32( _mm256_set1_epi8( _term ) );
+        while ( _end - p >= 32 ) {
+            __m256i v( _mm256_loadu_si256( ( const __m256i* )( p ) ) );
+            quint32 termMask( static_cast< quint32 >( _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, term32 ) ) ) );
+            quint32 oneMask( static_cast< quint32 >( _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, one32 ) ) ) );
+            quint32 validMask( static_cast< quint32 >( _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, zero32 ) ) ) | oneMask );
+            if ( termMask ) {
+                int len( countTrailingZeros( termMask ) );
+                quint32 keep( ( quint32( 1 ) << len ) - 1 );
+                appendSelected( validMask & keep, oneMask & keep, 0 );
+                return p + len + 1;
+            }
+            appendSelected( validMask, oneMask, 0xFFFFFFFFu );
+            p += 32;
+        }
+#endif
+
+#if defined( HIERARCHY_VIEW_SSE2 )
+        const __m128i zero16( _mm_set1_epi8( '0' ) );
+        const __m128i one16( _mm_set1_epi8( '1' ) );
+        const __m128i term16( _mm_set1_epi8( _term ) );
+        while ( _end - p >= 16 ) {
+            __m128i v( _mm_loadu_si128( ( const __m128i* )( p ) ) );
+            quint32 termMask( static_cast< quint32 >( _mm_movemask_epi8( _mm_cmpeq_epi8( v, term16 ) ) ) );
+            quint32 oneMask( static_cast< quint32 >( _mm_movemask_epi8( _mm_cmpeq_epi8( v, one16 ) ) ) );
+            quint32 validMask( static_cast< quint32 >( _mm_movemask_epi8( _mm_cmpeq_epi8( v, zero16 ) ) ) | oneMask );
+            if ( termMask ) {
+                int len( countTrailingZeros( termMask ) );
+                quint32 keep( ( quint32( 1 ) << len ) - 1 );
+                appendSelected( validMask & keep, oneMask & keep, 0 );
+                return p + len + 1;
+            }
+            appendSelected( validMask, oneMask, 0xFFFFu );
+            p += 16;
+        }
+#endif
+
+        while ( p < _end ) {
+            if ( *p == _term ) {
+                return p + 1;
+            }
+            if ( *p == '0' || *p == '1' ) {
+                push_back( *p == '1' );
+            }
+            ++p;
+        }
+        return p;
+    }
+
+    /// write the states in '[ _begin, _end )' as '0' / '1' characters into
+    /// '_out', which must hold at least '_end - _begin' characters, no
+    /// terminating '\0' is written
+    inline void toText( std::size_t _begin, std::size_t _end, char* _out ) const
+    {
+        std::size_t idx( _begin );
+
+#if defined( HIERARCHY_VIEW_AVX2 ) || defined( HIERARCHY_VIEW_SSE2 )
+        /// scalar head until a 16 bits boundary, so that a chunk never spans
+        /// across two words
+        for ( ; idx < _end && idx % 16 != 0; ++idx ) {
+            *_out++ = get( idx ) ? '1' : '0';
+        }
+#endif
+
+#if defined( HIERARCHY_VIEW_AVX2 )
+        /// byte 'i' takes the source byte 'i / 8', then tests bit 'i % 8'
+        const __m256i shuffle32( _mm256_setr_epi8( 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                   2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3 ) );
+        const __m256i bitMask32( _mm256_set1_epi64x( static_cast< long long >( 0x8040201008040201ULL ) ) );
+        const __m256i zero32( _mm256_set1_epi8( '0' ) );
+        for ( ; idx % 32 != 0 && idx + 16 <= _end; idx += 16 ) {
+            emitChunk16( static_cast< quint32 >( words_[ idx / kWordBits ] >> ( idx % kWordBits ) ) & 0xFFFFu, _out );
+            _out += 16;
+        }
+        for ( ; idx + 32 <= _end; idx += 32 ) {
+            quint32 bits( static_cast< quint32 >( words_[ idx / kWordBits ] >> ( idx % kWordBits ) ) );
+            __m256i v( _mm256_set1_epi32( static_cast< int >( bits ) ) );
+            v = _mm256_shuffle_epi8( v, shuffle32 );
+            v = _mm256_cmpeq_epi8( _mm256_and_si256( v, bitMask32 ), bitMask32 );
+            _mm256_storeu_si256( ( __m256i* )( _out ), _mm256_sub_epi8( zero32, v ) );
+            _out += 32;
+        }
+#endif
+
+#if defined( HIERARCHY_VIEW_SSE2 )
+        for ( ; idx + 16 <= _end; idx += 16 ) {
+            emitChunk16( static_cast< quint32 >( words_[ idx / kWordBits ] >> ( idx % kWordBits ) ) & 0xFFFFu, _out );
+            _out += 16;
+        }
+#endif
+
+        for ( ; idx < _end; ++idx ) {
+            *_out++ = get( idx ) ? '1' : '0';
+        }
+    }
+
+    /// append the whole states as text to '_str'
+    inline void appendText( std::string& _str ) const
+    {
+        std::size_t offset( _str.size() );
+        _str.resize( offset + size_ );
+        if ( size_ ) {
+            toText( 0, size_, &_str[ offset ] );
+        }
+    }
+
+    /// compact text form, four states per hex digit, the lowest bit first
+    inline void appendHex( std::string& _str ) const
+    {
+        std::size_t offset( _str.size() );
+        _str.resize( offset + hexSize() );
+        if ( size_ ) {
+            toHex( 0, hexSize(), &_str[ offset ] );
+        }
+    }
+
+    /// number of hex digits written by appendHex()
+    inline std::size_t hexSize() const { return ( size_ + 3 ) / 4; }
+
+    /// write the hex digits in '[ _begin, _end )' of appendHex() into '_out',
+    /// which must hold at least '_end - _begin' characters
+    inline void toHex( std::size_t _begin, std::size_t _end, char* _out ) const
+    {
+        static const char digits[] = "0123456789abcdef";
+        for ( std::size_t idx( _begin ); idx < _end; ++idx ) {
+            *_out++ = digits[ ( words_[ idx / 16 ] >> ( ( idx % 16 ) * 4 ) ) & 0xF ];
+        }
+    }
+
+    /// parse '_len' states written by appendHex() and append them, returns
+    /// where parsing stopped, NULL if the text is not valid
+    inline const char* parseHex( const char* _begin, const char* _end, std::size_t _len )
+    {
+        const char* p( _begin );
+        for ( std::size_t idx( 0 ); idx < _len; idx += 4, ++p ) {
+            if ( p >= _end ) {
+                return NULL;
+            }
+            int nibble( -1 );
+            if ( *p >= '0' && *p <= '9' ) {
+                nibble = *p - '0';
+            } else if ( *p >= 'a' && *p <= 'f' ) {
+                nibble = *p - 'a' + 10;
+            }
+            if ( nibble < 0 ) {
+                return NULL;
+            }
+            appendBits( static_cast< quint32 >( nibble ), static_cast< int >( std::min< std::size_t >( 4, _len - idx ) ) );
+        }
+        return p;
+    }
+
+private:
+    /// append the bits of '_oneMask' at the positions selected by
+    /// '_validMask', '_fullMask' is the value of '_validMask' when every byte
+    /// of the chunk is a state
+    inline void appendSelected( quint32 _validMask, quint32 _oneMask, quint32 _fullMask )
+    {
+        if ( _fullMask && _validMask == _fullMask ) {
+            /// the common case, a contiguous run of states
+            appendBits( _oneMask, _fullMask == 0xFFFFFFFFu ? 32 : 16 );
+            return;
+        }
+#if defined( __BMI2__ )
+        appendBits( _pext_u32( _oneMask, _validMask ), popCount( _validMask ) );
+#else
+        while ( _validMask ) {
+            push_back( ( _oneMask >> countTrailingZeros( _validMask ) ) & 1 );
+            _validMask &= _validMask - 1;
+        }
+#endif
+    }
+
+    /// the rank directory is a Fenwick tree over the set bits of the blocks
+    /// of kRankBlockWords words, 'ranks_[ i ]' ( 1-based ) sums the blocks
+    /// '[ i - lowbit( i ), i )'; rebuilt in O( N / 64 ) after bulk writes
+    inline void buildRanks()
+    {
+        std::size_t blockSize( ( words_.size() + kRankBlockWords - 1 ) / kRankBlockWords );
+        ranks_.assign( blockSize + 1, 0 );
+        for ( std::size_t idx( 0 ); idx < words_.size(); ++idx ) {
+            ranks_[ idx / kRankBlockWords + 1 ] += popCount( words_[ idx ] );
+        }
+        for ( std::size_t node( 1 ); node <= blockSize; ++node ) {
+            std::size_t parent( node + ( node & ( ~node + 1 ) ) );
+            if ( parent <= blockSize ) {
+                ranks_[ parent ] += ranks_[ node ];
+            }
+        }
+    }
+
+    /// add '_delta' set bits to block '_blockIdx', O( log N )
+    inline void addRank( std::size_t _blockIdx, int _delta )
+    {
+        for ( std::size_t node( _blockIdx + 1 ); node < ranks_.size(); node += node & ( ~node + 1 ) ) {
+            ranks_[ node ] += static_cast< std::size_t >( static_cast< std::ptrdiff_t >( _delta ) );
+        }
+    }
+
+    /// append an empty word, with a new node of the rank directory when it
+    /// starts a block; the node sums the blocks it covers, all but the new
+    /// one already counted by the directory
+    inline void pushWord()
+    {
+        words_.push_back( 0 );
+        if ( ( words_.size() - 1 ) % kRankBlockWords == 0 ) {
+            std::size_t node( ranks_.size() );
+            std::size_t sum( 0 );
+            for ( std::size_t child( node - 1 ); child > node - ( node & ( ~node + 1 ) ); child &= child - 1 ) {
+                sum += ranks_[ child ];
+            }
+            ranks_.push_back( sum );
+        }
+    }
+
+#if defined( HIERARCHY_VIEW_SSE2 )
+    static inline void emitChunk16( quint32 _bits, char* _out )
+    {
+        /// spread the low byte over bytes 0 - 7, the high byte over bytes 8 - 15
+        __m128i v( _mm_cvtsi32_si128( static_cast< int >( _bits ) ) );
+        v = _mm_unpacklo_epi8( v, v );
+        v = _mm_unpacklo_epi16( v, v );
+        v = _mm_unpacklo_epi32( v, v );
+        const __m128i bitMask( _mm_set_epi8( -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1 ) );
+        v = _mm_cmpeq_epi8( _mm_and_si128( v, bitMask ), bitMask );
+        _mm_storeu_si128( ( __m128i* )( _out ), _mm_sub_epi8( _mm_set1_epi8( '0' ), v ) );
+    }
+#endif
+
+private:
+    std::vector< WordT > words_;
+    std::size_t size_;
+    /// rank directory, see buildRanks()
+    std::vector< std::size_t > ranks_;
+};
+
+#endif
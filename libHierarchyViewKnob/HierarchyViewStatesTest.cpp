@@ -0,0 +1,248 @@
+// -----------------------------------------------------------------------------
+// 2009-2013 by Jupiter Jazz Limited.
+//
+// This software, excluded third party dependencies, is released in public domain,
+// see unlicense.txt file for more detail.
+//
+// IMPORTATNT:
+// NUKE is a trademark of The Foundry Visionmongers Ltd.
+// Qt is a trademark of Digia Plc and/or its subsidiary(-ies).
+// -----------------------------------------------------------------------------
+
+/// Fuzz test of HierarchyViewStates against the character loop used by
+/// from_script() before the states were packed, see "Compilation Guideline"
+/// in README.md; build it once per instruction set ( scalar, SSE2, AVX2,
+/// AVX2 + BMI2 ) since the SIMD paths are picked at compile time.
+/// Returns 0 when all the checks pass.
+
+#include "HierarchyViewStates.h"
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+
+/// small deterministic generator, the same sequence on every platform
+class Random
+{
+public:
+    explicit Random( unsigned long long _seed ) : state_( _seed * 2862933555777941757ULL + 3037000493ULL ) {}
+
+    inline unsigned int next()
+    {
+        state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast< unsigned int >( state_ >> 33 );
+    }
+
+    inline unsigned int below( unsigned int _n ) { return _n ? next() % _n : 0; }
+
+private:
+    unsigned long long state_;
+};
+
+int failures( 0 );
+
+void check( bool _ok, const char* _what, unsigned int _iteration )
+{
+    if ( !_ok ) {
+        ::fprintf( stderr, "FAILED: %s, iteration %u\n", _what, _iteration );
+        ++failures;
+    }
+}
+
+/// the parser of the states before HierarchyViewStates, kept as reference
+void referenceParse( const std::string& _v, std::string& _allStates, std::string& _itemStates )
+{
+    _allStates.clear();
+    _itemStates.clear();
+    std::size_t idx( 0 );
+    while ( idx < _v.size() ) {
+        if ( _v[ idx ] == ',' ) {
+            ++idx;
+            break;
+        }
+        if ( _v[ idx ] == '0' || _v[ idx ] == '1' ) {
+            _allStates.push_back( _v[ idx ] );
+        }
+        ++idx;
+    }
+    while ( idx < _v.size() ) {
+        if ( _v[ idx ] == ']' ) {
+            ++idx;
+            break;
+        }
+        if ( _v[ idx ] == '0' || _v[ idx ] == '1' ) {
+            _itemStates.push_back( _v[ idx ] );
+        }
+        ++idx;
+    }
+}
+
+/// scripts made of long runs of states with a few other characters, or of
+/// any characters, so both the SIMD fast path and the fallback are covered
+std::string randomScript( Random& _random )
+{
+    static const char alphabet[] = "0101010101[],x 01\n";
+    std::string v;
+    unsigned int len( _random.below( 600 ) );
+    unsigned int noise( _random.below( 3 ) == 0 ? 100 : _random.below( 12 ) );
+    for ( unsigned int idx( 0 ); idx < len; ++idx ) {
+        if ( _random.below( 100 ) < noise ) {
+            v.push_back( alphabet[ _random.below( sizeof( alphabet ) - 1 ) ] );
+        } else {
+            v.push_back( _random.below( 2 ) ? '1' : '0' );
+        }
+    }
+    return v;
+}
+
+void checkQueries( const HierarchyViewStates& _states, const std::string& _text, Random& _random, unsigned int _iteration )
+{
+    /// bits beyond size() are kept zero
+    if ( _states.size() % HierarchyViewStates::kWordBits ) {
+        check( !( _states.words()[ _states.wordSize() - 1 ] >> ( _states.size() % HierarchyViewStates::kWordBits ) ), "zero tail", _iteration );
+    }
+
+    std::size_t ones( 0 );
+    for ( std::size_t idx( 0 ); idx < _text.size(); ++idx ) {
+        check( _states.rank( idx ) == ones, "rank", _iteration );
+        ones += _text[ idx ] == '1' ? 1 : 0;
+    }
+    check( _states.count() == ones, "count", _iteration );
+
+    std::size_t begin( _random.below( static_cast< unsigned int >( _text.size() + 1 ) ) );
+    std::size_t end( begin + _random.below( static_cast< unsigned int >( _text.size() - begin + 1 ) ) );
+    std::size_t rangeOnes( 0 );
+    for ( std::size_t idx( begin ); idx < end; ++idx ) {
+        rangeOnes += _text[ idx ] == '1' ? 1 : 0;
+    }
+    check( _states.count( begin, end ) == rangeOnes, "count range", _iteration );
+
+    std::string emitted( end - begin, '?' );
+    if ( end > begin ) {
+        _states.toText( begin, end, &emitted[ 0 ] );
+    }
+    check( emitted == _text.substr( begin, end - begin ), "toText range", _iteration );
+
+    for ( int v( 0 ); v < 2; ++v ) {
+        std::size_t expected( _text.find( v ? '1' : '0', begin ) );
+        check( _states.findNext( begin, v != 0 ) == ( expected == std::string::npos ? _text.size() : expected ), "findNext", _iteration );
+    }
+}
+
+/// large states, so that the rank directory has many blocks: appended by
+/// push_back() and appendBits(), then toggled by set(), every query checked
+/// against a naive count
+void checkLargeStates( Random& _random )
+{
+    HierarchyViewStates states;
+    std::vector< bool > bits;
+    while ( bits.size() < 200000 ) {
+        if ( _random.below( 2 ) ) {
+            bool v( _random.below( 4 ) == 0 );
+            states.push_back( v );
+            bits.push_back( v );
+        } else {
+            int len( static_cast< int >( _random.below( 33 ) ) );
+            quint32 v( _random.next() ^ ( _random.next() << 16 ) );
+            states.appendBits( v, len );
+            for ( int idx( 0 ); idx < len; ++idx ) {
+                bits.push_back( ( v >> idx ) & 1 );
+            }
+        }
+    }
+    for ( unsigned int iteration( 0 ); iteration < 2000; ++iteration ) {
+        for ( int toggle( 0 ); toggle < 50; ++toggle ) {
+            std::size_t idx( _random.below( static_cast< unsigned int >( bits.size() ) ) );
+            bits[ idx ] = !bits[ idx ];
+            states.set( idx, bits[ idx ] );
+        }
+        std::size_t begin( _random.below( static_cast< unsigned int >( bits.size() + 1 ) ) );
+        std::size_t end( begin + _random.below( static_cast< unsigned int >( bits.size() - begin + 1 ) ) );
+        std::size_t expected( 0 );
+        for ( std::size_t idx( begin ); idx < end; ++idx ) {
+            expected += bits[ idx ] ? 1 : 0;
+        }
+        check( states.count( begin, end ) == expected, "large count range", iteration );
+    }
+    std::size_t expected( 0 );
+    for ( std::size_t idx( 0 ); idx < bits.size(); ++idx ) {
+        expected += bits[ idx ] ? 1 : 0;
+    }
+    check( states.count() == expected, "large count", 0 );
+    HierarchyViewStates copy( states );
+    copy.xorWith( states );
+    check( copy.count() == 0, "large xorWith", 0 );
+}
+
+} // namespace
+
+int main()
+{
+    Random random( 1 );
+    for ( unsigned int iteration( 0 ); iteration < 20000; ++iteration ) {
+        std::string v( randomScript( random ) );
+        std::string allText, itemText;
+        referenceParse( v, allText, itemText );
+
+        HierarchyViewStates allStates, itemStates;
+        const char* end( v.data() + v.size() );
+        const char* pos( allStates.parse( v.data(), end, ',' ) );
+        itemStates.parse( pos, end, ']' );
+
+        std::string text;
+        allStates.appendText( text );
+        check( text == allText, "parse all states", iteration );
+        text.clear();
+        itemStates.appendText( text );
+        check( text == itemText, "parse item states", iteration );
+
+        checkQueries( allStates, allText, random, iteration );
+
+        /// hex round trip, a trailing character must be left unparsed
+        std::string hex;
+        allStates.appendHex( hex );
+        hex.push_back( '}' );
+        HierarchyViewStates fromHex;
+        const char* hexEnd( fromHex.parseHex( hex.data(), hex.data() + hex.size(), allStates.size() ) );
+        check( fromHex == allStates && hexEnd && *hexEnd == '}', "hex round trip", iteration );
+
+        /// a state flipped after the queries, so that cached counts go stale
+        if ( !allText.empty() ) {
+            std::size_t idx( random.below( static_cast< unsigned int >( allText.size() ) ) );
+            allText[ idx ] = allText[ idx ] == '1' ? '0' : '1';
+            allStates.set( idx, allText[ idx ] == '1' );
+            checkQueries( allStates, allText, random, iteration );
+        }
+
+        HierarchyViewStates delta( allStates );
+        delta.xorWith( allStates );
+        check( delta.count() == 0 && delta.size() == allStates.size(), "xorWith", iteration );
+
+        /// a random run flipped, the result queried like any other states
+        if ( !allText.empty() ) {
+            std::size_t begin( random.below( static_cast< unsigned int >( allText.size() + 1 ) ) );
+            std::size_t end( begin + random.below( static_cast< unsigned int >( allText.size() - begin + 1 ) ) );
+            for ( std::size_t idx( begin ); idx < end; ++idx ) {
+                allText[ idx ] = allText[ idx ] == '1' ? '0' : '1';
+            }
+            allStates.flip( begin, end );
+            text.clear();
+            allStates.appendText( text );
+            check( text == allText, "flip", iteration );
+            checkQueries( allStates, allText, random, iteration );
+        }
+    }
+
+    checkLargeStates( random );
+
+    if ( failures ) {
+        ::fprintf( stderr, "%d checks failed\n", failures );
+        return 1;
+    }
+    ::printf( "HierarchyViewStatesTest: all checks passed\n" );
+    return 0;
+}
@@ -14,14 +14,40 @@
 
 #include <DDImage/Knob.h>
 
+#include "HierarchyViewKnob.h"
+
 #include <QtCore/QObject>
 #include <QtGui>
 #include <QTreeWidget>
-#include <QHash>
+#include <QCache>
 #include <QPair>
 #include <QVector>
 
-class HierarchyViewKnob;
+/// tree item of HierarchyViewWidget, the extra columns are not stored in the
+/// item but fetched from the column provider when the view asks for them,
+/// a.k.a only for the rows being shown.
+/// The item carries its absolute index and the index of its original item,
+/// so no lookup table is needed to map an item back to the knob.
+class HierarchyViewItem : public QTreeWidgetItem
+{
+public:
+    HierarchyViewItem( int _absIdx );
+
+    inline int absIndex() const { return absIdx_; }
+    inline void setAbsIndex( int _idx ) { absIdx_ = _idx; }
+    /// index of the original item ending at this item, -1 for none
+    inline int itemIndex() const { return itemIdx_; }
+    inline void setItemIndex( int _idx ) { itemIdx_ = _idx; }
+
+    virtual QVariant data( int _column, int _role ) const;
+    virtual void setData( int _column, int _role, const QVariant& _value );
+    virtual bool operator<( const QTreeWidgetItem& _other ) const;
+
+private:
+    int absIdx_;
+    int itemIdx_;
+};
+
 class HierarchyViewWidget : public QTreeWidget
 {
     Q_OBJECT
@@ -34,36 +60,76 @@ public:
     void destroy();
     static int WidgetCallback( void* _closure, DD::Image::Knob::CallbackReason _reason );
 
-    /// get and set absolute indices, a.k.a indices after the hierarchy being flattened
-    int  getAbsIndex( QTreeWidgetItem* _item ) const;
+    /// get and set absolute indices, a.k.a indices after the hierarchy being
+    /// flattened, stored in the HierarchyViewItem itself, -1 for other items
+    int  getAbsIndex( const QTreeWidgetItem* _item ) const;
     void setAbsIndex( QTreeWidgetItem* _item, int _idx );
 
-    /// get the original indices, a.k.a indices before the hierarchy being flattened
-    const QVector< QPair< QString, QTreeWidgetItem* > >& itemIndices() const;
-    QVector< QPair< QString, QTreeWidgetItem* > >& itemIndices();
-
-    /// traverse all parent items to get the state
-    bool parentItemState( QTreeWidgetItem* parentItem ) const;
-
     /// get and set updating state, provided for convenience to indicate the state when widget update
     bool getSuspendUpdate() const;
     void setSuspendUpdate( bool _suspendUpdate );
 
+    /// bulk update for programmatic changes of many items, signals of the
+    /// widget and its model are blocked in between, so no itemChanged() nor
+    /// per item repaint; the viewport is repainted once at the outermost end.
+    /// NOTE: only item data may change in between, not the structure
+    void beginBulkUpdate();
+    void endBulkUpdate();
+    bool inBulkUpdate() const;
+
+    /// set the extra columns and their provider, see HierarchyViewKnob::setColumns()
+    void setColumns( const QStringList& _labels, HierarchyViewKnob::ColumnCallback _cb, void* _closure );
+    /// get the name of an item, decoded from the knob, the items keep no text
+    QString nameText( const QTreeWidgetItem* _item ) const;
+    /// get the text of an extra column, cached in a bounded LRU
+    QString columnText( const QTreeWidgetItem* _item, int _column ) const;
+    /// compare two items by an extra column, see HierarchyViewItem::operator<()
+    bool lessThan( const QTreeWidgetItem* _lhs, const QTreeWidgetItem* _rhs, int _column ) const;
+    /// drop the cached column texts
+    void invalidateColumns();
+
+    /// memory of the tree items with their index tables, and of the caches
+    void memoryUsage( std::size_t& _items, std::size_t& _caches ) const;
+
 public Q_SLOTS:
     void valueChanged( QTreeWidgetItem* _item , int _column );
 
+private Q_SLOTS:
+    /// the model sorts in between, see sortKeys_
+    void beginSort();
+    void endSort();
+
 protected:
     virtual void wheelEvent( QWheelEvent* _event );
 
 private:
     /// the knob which this widget belongs to
     HierarchyViewKnob* knob_;
-    /// absolute indices
-    QHash< QTreeWidgetItem*, int > absIdxHash_;
-    /// original indices
-    QVector< QPair< QString, QTreeWidgetItem* > > idxArray_;
     /// updating flag
     bool suspendUpdate_;
+    /// nesting level of beginBulkUpdate() and the signal states before it
+    int bulkUpdateDepth_;
+    bool signalsBlocked_;
+    bool modelSignalsBlocked_;
+    /// extra columns provider
+    HierarchyViewKnob::ColumnCallback columnCB_;
+    void* columnClosure_;
+    /// column texts, keyed by absolute index and column
+    mutable QCache< quint64, QString > columnCache_;
+
+    /// sort key of a row, numbers are compared by value
+    struct SortKey {
+        QString text;
+        double value;
+        bool isNumber;
+    };
+    SortKey sortKey( const QTreeWidgetItem* _item, int _column ) const;
+    QString fetchColumnText( int _idx, int _itemIdx, int _column ) const;
+    /// while the model sorts, the key of every compared row is fetched once
+    /// and kept here, keyed by absolute index, rather than going through the
+    /// LRU on every comparison; dropped when the sort ends
+    bool sorting_;
+    mutable QHash< int, SortKey > sortKeys_;
 };
 
 #endif